@@ -112,4 +112,40 @@ int extract_realloc2(extract_alloc_t *alloc, void **pptr, size_t oldsize, size_t
 
 void extract_alloc_exp_min(extract_alloc_t *alloc, size_t size);
 
+/*
+	Enables or disables pooling of blocks allocated with
+	extract_malloc_pooled(). When enabled, blocks of the same size
+	are carved consecutively from large slabs, so that they are
+	adjacent in memory, and freed blocks are kept for reuse until
+	pooling is disabled or <alloc> is destroyed.
+
+	Extract uses this for the nodes of its content tree (spans,
+	lines, paragraphs and blocks).
+
+	Pooling can only be enabled while there are no blocks from
+	extract_malloc_pooled() that have not been freed, and only
+	disabled while there are no pooled blocks that have not been
+	freed; typically it is enabled straight after
+	extract_alloc_create() and disabled just before
+	extract_alloc_destroy(), or not disabled at all.
+
+	Returns -1 with errno=EINVAL if <alloc> is NULL, or with
+	errno=EBUSY if pooling cannot be enabled or disabled because
+	of blocks that have not been freed.
+*/
+int extract_alloc_pool(extract_alloc_t *alloc, int enable);
+
+/*
+	Like extract_malloc() and extract_free(), but use <alloc>'s pool
+	if pooling is enabled. A block must be freed with
+	extract_free_pooled() using the same <size> that it was
+	allocated with.
+*/
+int extract_malloc_pooled(extract_alloc_t *alloc, void **pptr, size_t size);
+
+void extract_free_pooled(extract_alloc_t *alloc, void **pptr, size_t size);
+
+#define extract_malloc_pooled(alloc, pptr, size) (extract_malloc_pooled)(alloc, (void**) pptr, size)
+#define extract_free_pooled(alloc, pptr, size)   (extract_free_pooled)  (alloc, (void**) pptr, size)
+
 #endif
@@ -259,9 +259,11 @@ int extract_buffer_open_simple(extract_alloc_t           *alloc,
 
 /*
 	Creates a buffer that reads from, or writes to, a file.
-	For portability uses an internal FILE* rather than an
-	integer file descriptor, so doesn't use	extract_buffer's
-	caching support because FILE* already provides caching.
+
+	For portability uses an internal FILE*, but with stdio's own
+	buffering disabled; instead reads and writes go through
+	extract_buffer's cache, using blocks of
+	extract_buffer_file_BLOCK_SIZE bytes.
 
 	path:
 		Path of file to read from.
@@ -275,6 +277,24 @@ int extract_buffer_open_file(extract_alloc_t      *alloc,
 				int                writable,
 				extract_buffer_t **o_buffer);
 
+/* Default cache block size for file buffers. */
+#define extract_buffer_file_BLOCK_SIZE (1024 * 1024)
+
+/*
+	Like extract_buffer_open_file() but with a specified cache
+	block size.
+
+	block_size:
+		Size of cache block; the file is read or written in
+		blocks of this size. If zero we use
+		extract_buffer_file_BLOCK_SIZE.
+*/
+int extract_buffer_open_file2(extract_alloc_t      *alloc,
+				const char        *path,
+				int                writable,
+				size_t             block_size,
+				extract_buffer_t **o_buffer);
+
 
 /*
 	A write buffer that writes to an automatically-growing
@@ -345,8 +365,9 @@ static inline int extract_buffer_read(
 		/* Can't use just the cache. */
 		return extract_buffer_read_internal(buffer, data, numbytes, o_actual);
 	}
-	/* We can use just the cache. */
-	memcpy(data, (char *)cache->cache + cache->pos, numbytes);
+	/* We can use just the cache. <cache->cache> is NULL if the buffer has no
+	cache, in which case we only get here with numbytes == 0. */
+	if (numbytes) memcpy(data, (char *)cache->cache + cache->pos, numbytes);
 	cache->pos += numbytes;
 	if (o_actual) *o_actual = numbytes;
 	return 0;
@@ -373,8 +394,8 @@ static inline int extract_buffer_write(
 		/* Can't use just the cache. */
 		return extract_buffer_write_internal(buffer, data, numbytes, o_actual);
 	}
-	/* We can use just the cache. */
-	memcpy((char *)cache->cache + cache->pos, data, numbytes);
+	/* We can use just the cache; see extract_buffer_read(). */
+	if (numbytes) memcpy((char *)cache->cache + cache->pos, data, numbytes);
 	cache->pos += numbytes;
 	if (o_actual) *o_actual = numbytes;
 	return 0;
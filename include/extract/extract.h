@@ -210,7 +210,13 @@ int extract_add_line(
 /* Alternative to extract_add_path4(). Should be followed by calls to
 extract_moveto(), extract_lineto() and extract_closepath(), which are used
 to find lines that may define tables. extract_fill_end() should be called
-afterwards. */
+afterwards.
+
+The path can contain any number of subpaths, e.g. a whole table's rules drawn
+as one compound path; each subpath that is a thin axis-aligned rectangle is
+used as a table line. Subpaths need not be explicitly closed. Curves should
+be passed as a lineto to their end point, and will simply cause the
+containing subpath to be ignored if it then has too many points. */
 int extract_fill_begin(
 		extract_t *extract,
 		double     ctm_a,
@@ -223,8 +229,12 @@ int extract_fill_begin(
 
 /* Alternative to extract_add_line(). Should be followed by calls to
 extract_moveto(), extract_lineto() and extract_closepath(), which are used
-to find lines that may define tables. extract_fill_end() should be called
-afterwards. */
+to find lines that may define tables. extract_stroke_end() should be called
+afterwards.
+
+Each line segment of each subpath is treated as if passed to
+extract_add_line(); extract_closepath() adds a segment back to the start of
+the current subpath. */
 int extract_stroke_begin(
 		extract_t *extract,
 		double     ctm_a,
@@ -421,10 +431,122 @@ int extract_write_template(
 /* Frees all data associated with *pextract and sets *pextract to NULL. */
 void extract_end(extract_t **pextract);
 
+/* Discards all pages, content, images and styles, so that <extract> is
+ready to be used for a new document as if returned by extract_begin().
+Settings such as those from extract_set_layout_analysis(),
+extract_set_profile() and extract_set_progress_fn() are kept, as are
+allocated buffers, so a single extract_t can be reused for many documents
+without the cost of allocating them again. */
+int extract_reset(extract_t *extract);
+
 
 /* Enables/Disables the layout analysis phase. */
 int extract_set_layout_analysis(extract_t *extract, int enable);
 
+/*
+	Processing profiles for extract_set_profile():
+
+	extract_profile_FULL:
+		Runs all stages. This is the default.
+
+	extract_profile_BALANCED:
+		As extract_profile_FULL, but does not do layout analysis even if
+		enabled with extract_set_layout_analysis(), and does not look for
+		paragraph alignment and justification, so all paragraphs are output
+		as left-aligned.
+
+	extract_profile_FAST:
+		As extract_profile_BALANCED, and also does not look for tables, so
+		text in tables is output as ordinary paragraphs. Chars are only joined
+		into lines as they are added to a span, and a line is only joined to
+		the paragraph immediately before it, so text that is drawn out of
+		reading order may be split into more lines and paragraphs.
+*/
+typedef enum
+{
+	extract_profile_FULL,
+	extract_profile_BALANCED,
+	extract_profile_FAST
+} extract_profile_t;
+
+/* Selects which processing stages extract_process() runs. */
+int extract_set_profile(extract_t *extract, extract_profile_t profile);
+
+/* Enables/Disables removal of glyphs that overprint an earlier glyph with the
+same unicode value at almost the same position, as is often done to fake bold
+text. The glyph that is kept is made bold. Disabled by default. */
+int extract_set_overprint_dedup(extract_t *extract, int enable);
+
+/* Enables/Disables removal of chars whose bbox lies entirely outside the
+page's mediabox or outside the clip rect set by extract_set_clip(). Disabled
+by default. */
+int extract_set_cull_invisible(extract_t *extract, int enable);
+
+/* Sets the clip rect used by extract_set_cull_invisible() for chars added
+after this call, until the end of the current page. extract_read_intermediate()
+applies the clip rect that is set when it is called to all of the pages that it
+reads. */
+int extract_set_clip(extract_t *extract, double x0, double y0, double x1, double y1);
+
+/* Sets limits on the work that extract_process() does for each page. A page
+with more than <max_spans> spans or more than <max_tablelines> table lines is
+processed as for extract_profile_FAST. If processing a page takes more than
+<max_seconds> of wall-clock time, the remaining work on that page is also done
+as for extract_profile_FAST. Zero means no limit, which is the default. */
+int extract_set_page_limits(extract_t *extract, int max_spans, int max_tablelines, double max_seconds);
+
+/* Counts of pages that were degraded by the limits set with
+extract_set_page_limits(). */
+typedef struct
+{
+	/* Pages that had more than max_spans spans. */
+	int  pages_degraded_spans;
+
+	/* Pages that had more than max_tablelines table lines. */
+	int  pages_degraded_tablelines;
+
+	/* Pages where max_seconds passed before some work was done, so that the
+	work was skipped or shortened. */
+	int  pages_degraded_time;
+} extract_page_stats_t;
+
+/* Sets *o_stats to the counts for all pages processed by extract_process()
+since extract_begin() or the last extract_reset(). */
+int extract_get_page_stats(extract_t *extract, extract_page_stats_t *o_stats);
+
+/* Stages reported to an extract_progress_fn. */
+typedef enum
+{
+	/* extract_process(): about to do layout analysis of page <n>. */
+	extract_progress_ANALYSE,
+
+	/* extract_process(): about to look for tables on page <n>. */
+	extract_progress_TABLES,
+
+	/* extract_process(): about to join spans into lines and paragraphs on
+	page <n>. */
+	extract_progress_PARAGRAPHS,
+
+	/* extract_process(): about to generate output content for all pages;
+	reported once, with <n>=0 and <n_max>=1. */
+	extract_progress_CONTENT,
+
+	/* extract_write(): about to write zip entry or content string <n>. */
+	extract_progress_WRITE
+} extract_progress_stage_t;
+
+/* Callback for extract_set_progress_fn(). <n> counts from zero up to
+<n_max>-1 within each stage; pages count from zero up to the number of pages
+that extract_process() is processing. If this returns non-zero,
+extract_process() or extract_write() stops and returns -1 with errno set to
+ECANCELED. After this the extract_t can only be passed to extract_reset(),
+to start again with a new document, or to extract_end(). */
+typedef int (extract_progress_fn)(void *handle, extract_progress_stage_t stage, int n, int n_max);
+
+/* Sets the function that extract_process() and extract_write() call to
+report progress and to check for cancellation. <fn> can be NULL. */
+int extract_set_progress_fn(extract_t *extract, extract_progress_fn *fn, void *handle);
+
 typedef enum
 {
 	EXTRACT_CLASSIFY_UNKNOWN = 0,
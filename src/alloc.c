@@ -6,12 +6,44 @@
 #include <string.h>
 
 
+/* Pooled blocks are carved from slabs of this size. */
+#define POOL_SLAB_SIZE (64 * 1024)
+
+/* Slabs start with a pointer to the previous slab, padded so that blocks
+are aligned. */
+#define POOL_SLAB_HEADER 16
+
+/* Maximum number of distinct block sizes that we pool. */
+#define POOL_CLASSES_MAX 8
+
+typedef struct
+{
+	size_t  size;
+	void   *free;    /* Singly-linked list of freed blocks. */
+	char   *next;    /* Unused space in the current slab for this size. */
+	char   *end;
+} pool_class_t;
+
+typedef struct
+{
+	/* Number of pooled blocks that have not been freed. */
+	int           live;
+	/* Singly-linked list of all slabs. */
+	void         *slabs;
+	pool_class_t  classes[POOL_CLASSES_MAX];
+	int           classes_num;
+} pool_t;
+
 struct extract_alloc_t
 {
 	extract_realloc_fn_t     *realloc_fn;
 	extract_caller_context_t *realloc_state;
 	size_t                    exp_min_alloc_size;
 	extract_alloc_stats_t     stats;
+	pool_t                   *pool;    /* NULL unless pooling is enabled. */
+	/* Number of blocks from extract_malloc_pooled() that were not taken
+	from the pool and have not been freed. */
+	int                       unpooled_live;
 };
 
 int
@@ -30,12 +62,25 @@ extract_alloc_create(	extract_realloc_fn_t *realloc_fn,
 	(*palloc)->realloc_fn = realloc_fn;
 	(*palloc)->realloc_state = realloc_state;
 	(*palloc)->exp_min_alloc_size = 0;
+	(*palloc)->pool = NULL;
 	return 0;
 }
 
+static void pool_free(extract_alloc_t *alloc)
+{
+	while (alloc->pool->slabs)
+	{
+		void *slab = alloc->pool->slabs;
+		alloc->pool->slabs = *(void **) slab;
+		extract_free(alloc, &slab);
+	}
+	extract_free(alloc, &alloc->pool);
+}
+
 void extract_alloc_destroy(extract_alloc_t **palloc)
 {
 	if (!*palloc) return;
+	if ((*palloc)->pool) pool_free(*palloc);
 	(*palloc)->realloc_fn((*palloc)->realloc_state, *palloc, 0 /*newsize*/);
 	*palloc = NULL;
 }
@@ -117,3 +162,128 @@ void extract_alloc_exp_min(extract_alloc_t *alloc, size_t size)
 {
 	alloc->exp_min_alloc_size = size;
 }
+
+int extract_alloc_pool(extract_alloc_t *alloc, int enable)
+{
+	if (!alloc)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (!enable == !alloc->pool)
+		return 0;
+	if (alloc->pool && alloc->pool->live)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	if (enable && alloc->unpooled_live)
+	{
+		/* These blocks would be put onto a free list if they were freed
+		after we enable pooling. */
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (enable)
+	{
+		if (extract_malloc(alloc, &alloc->pool, sizeof(*alloc->pool))) return -1;
+		memset(alloc->pool, 0, sizeof(*alloc->pool));
+	}
+	else
+	{
+		pool_free(alloc);
+	}
+
+	return 0;
+}
+
+/* Returns the pool class for blocks of <size> bytes, adding one if <add> is
+non-zero and there is room. Returns NULL if there is no suitable class. */
+static pool_class_t *pool_class(pool_t *pool, size_t size, int add)
+{
+	pool_class_t *c;
+	int           i;
+
+	size = (size + 15) & ~(size_t) 15;
+	for (i = 0; i < pool->classes_num; ++i)
+	{
+		if (pool->classes[i].size == size)
+			return &pool->classes[i];
+	}
+	if (!add || pool->classes_num == POOL_CLASSES_MAX)
+		return NULL;
+
+	c = &pool->classes[pool->classes_num++];
+	c->size = size;
+	c->free = NULL;
+	c->next = NULL;
+	c->end = NULL;
+
+	return c;
+}
+
+/* Allocates a block that is not in the pool, for extract_malloc_pooled(). */
+static int malloc_unpooled(extract_alloc_t *alloc, void **pptr, size_t size)
+{
+	if ((extract_malloc)(alloc, pptr, size)) return -1;
+	if (alloc && *pptr) alloc->unpooled_live += 1;
+	return 0;
+}
+
+int (extract_malloc_pooled)(extract_alloc_t *alloc, void **pptr, size_t size)
+{
+	pool_class_t *c;
+
+	if (!alloc || !alloc->pool || size == 0)
+		return malloc_unpooled(alloc, pptr, size);
+	c = pool_class(alloc->pool, size, 1 /*add*/);
+	if (!c)
+		return malloc_unpooled(alloc, pptr, size);
+
+	if (c->free)
+	{
+		*pptr = c->free;
+		c->free = *(void **) c->free;
+	}
+	else
+	{
+		if ((size_t) (c->end - c->next) < c->size)
+		{
+			/* Start a new slab for this size, so that consecutively
+			allocated blocks are adjacent in memory. */
+			char   *slab;
+			size_t  slab_size = POOL_SLAB_HEADER + ((c->size > POOL_SLAB_SIZE) ? c->size : POOL_SLAB_SIZE);
+
+			if (extract_malloc(alloc, &slab, slab_size)) return -1;
+			*(void **) slab = alloc->pool->slabs;
+			alloc->pool->slabs = slab;
+			c->next = slab + POOL_SLAB_HEADER;
+			c->end = slab + slab_size;
+		}
+		*pptr = c->next;
+		c->next += c->size;
+	}
+	alloc->pool->live += 1;
+
+	return 0;
+}
+
+void (extract_free_pooled)(extract_alloc_t *alloc, void **pptr, size_t size)
+{
+	pool_class_t *c;
+
+	if (!alloc || !alloc->pool || size == 0 || !(c = pool_class(alloc->pool, size, 0 /*add*/)))
+	{
+		if (alloc && *pptr) alloc->unpooled_live -= 1;
+		(extract_free)(alloc, pptr);
+		return;
+	}
+	if (!*pptr)
+		return;
+
+	*(void **) *pptr = c->free;
+	c->free = *pptr;
+	*pptr = NULL;
+	alloc->pool->live -= 1;
+}
@@ -13,6 +13,7 @@ void extract_astring_init(extract_astring_t *string)
 {
 	string->chars = NULL;
 	string->chars_num = 0;
+	string->chars_max = 0;
 }
 
 void extract_astring_free(extract_alloc_t *alloc, extract_astring_t *string)
@@ -21,12 +22,36 @@ void extract_astring_free(extract_alloc_t *alloc, extract_astring_t *string)
 	extract_astring_init(string);
 }
 
+void extract_astring_clear(extract_astring_t *string)
+{
+	string->chars_num = 0;
+	if (string->chars) string->chars[0] = 0;
+}
+
+/* Ensures that <string> has space for <n> more chars plus terminating zero,
+growing exponentially to avoid many calls to realloc when appending small
+amounts. */
+static int astring_reserve(extract_alloc_t *alloc, extract_astring_t *string, size_t n)
+{
+	size_t chars_max;
+
+	if (string->chars_num + n + 1 <= string->chars_max) return 0;
+
+	chars_max = string->chars_max ? string->chars_max * 2 : 32;
+	if (chars_max < string->chars_num + n + 1)
+		chars_max = string->chars_num + n + 1;
+	if (extract_realloc2(alloc, &string->chars, string->chars_max, chars_max))
+		return -1;
+	string->chars_max = chars_max;
+
+	return 0;
+}
 
 int extract_astring_catl(extract_alloc_t *alloc, extract_astring_t *string, const char *s, size_t s_len)
 {
-	if (extract_realloc2(alloc, &string->chars, string->chars_num+1, string->chars_num + s_len + 1))
+	if (astring_reserve(alloc, string, s_len))
 		return -1;
-	/* Coverity doesn't seem to realise that extract_realloc2() modifies
+	/* Coverity doesn't seem to realise that astring_reserve() modifies
 	string->chars. */
 	/* coverity[deref_parm_field_in_call] */
 	memcpy(string->chars + string->chars_num, s, s_len);
@@ -47,18 +72,171 @@ int extract_astring_cat(extract_alloc_t *alloc, extract_astring_t *string, const
 
 int extract_astring_catf(extract_alloc_t *alloc, extract_astring_t *string, const char *format, ...)
 {
-	char    *buffer = NULL;
-	int      e;
+	int      n;
 	va_list  va;
 
+	/* Try to format into the existing spare capacity; if it doesn't fit,
+	vsnprintf() tells us how much space we need. */
 	va_start(va, format);
-	e = extract_vasprintf(alloc, &buffer, format, va);
+	if (string->chars)
+		n = vsnprintf(string->chars + string->chars_num, string->chars_max - string->chars_num, format, va);
+	else
+		n = vsnprintf(NULL, 0, format, va);
 	va_end(va);
-	if (e < 0) return e;
-	e = extract_astring_cat(alloc, string, buffer);
-	extract_free(alloc, &buffer);
+	if (n < 0) goto fail;
+
+	if (string->chars_num + n + 1 > string->chars_max)
+	{
+		if (astring_reserve(alloc, string, n)) goto fail;
+		va_start(va, format);
+		vsnprintf(string->chars + string->chars_num, n + 1, format, va);
+		va_end(va);
+	}
+	string->chars_num += n;
+
+	return 0;
 
-	return e;
+fail:
+	/* vsnprintf() may have overwritten our terminating zero. */
+	if (string->chars) string->chars[string->chars_num] = 0;
+	return -1;
+}
+
+/* Powers of ten that are exactly representable as doubles. */
+static const double s_pow10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+};
+
+/* Writes <value> formatted as by printf("%.*f", precision, value) to
+<buffer>, which must have space for 32 chars, and returns length. Returns
+-1 if we cannot be sure of getting exactly the same result as printf, e.g.
+because value is too large or very close to a rounding boundary.
+
+If o_digits is not NULL, we set *o_digits to the rounded absolute value
+scaled by 10^precision. */
+static int format_fixed(char *buffer, double value, int precision, unsigned long long *o_digits)
+{
+	unsigned long long  n;
+	unsigned long long  int_part;
+	unsigned long long  frac_part;
+	double              scaled;
+	double              a;
+	double              frac;
+	double              margin;
+	char                digits[24];
+	int                 digits_num;
+	int                 len = 0;
+	int                 negative;
+	int                 i;
+
+	if (precision < 0 || precision >= (int) (sizeof(s_pow10) / sizeof(s_pow10[0])))
+		return -1;
+
+	/* NaN fails this comparison. */
+	scaled = value * s_pow10[precision];
+	a = (scaled < 0) ? -scaled : scaled;
+	if (!(a < 17592186044416.0 /* 2^44 */))
+		return -1;
+
+	/* The product above may be wrong by half an ulp, i.e. at most a*2^-53;
+	we fall back to printf if this could affect rounding. */
+	n = (unsigned long long) a;
+	frac = a - (double) n;
+	margin = a * (1.0 / 4503599627370496.0 /* 2^52 */);
+	if (frac > 0.5 - margin && frac < 0.5 + margin)
+		return -1;
+	if (frac > 0.5) n += 1;
+
+	/* printf shows the sign of negative values even if they round to zero,
+	and of negative zero, so look at the sign bit. */
+	{
+		unsigned long long bits;
+		memcpy(&bits, &value, sizeof(bits));
+		negative = (int) (bits >> 63);
+	}
+
+	if (o_digits) *o_digits = n;
+	int_part = n / (unsigned long long) s_pow10[precision];
+	frac_part = n % (unsigned long long) s_pow10[precision];
+
+	if (negative) buffer[len++] = '-';
+	digits_num = 0;
+	do
+	{
+		digits[digits_num++] = (char) ('0' + int_part % 10);
+		int_part /= 10;
+	} while (int_part);
+	while (digits_num)
+		buffer[len++] = digits[--digits_num];
+	if (precision)
+	{
+		buffer[len++] = '.';
+		for (i=precision-1; i>=0; --i)
+		{
+			buffer[len+i] = (char) ('0' + frac_part % 10);
+			frac_part /= 10;
+		}
+		len += precision;
+	}
+	buffer[len] = 0;
+
+	return len;
+}
+
+int extract_astring_catd(extract_alloc_t *alloc, extract_astring_t *string, double value, int precision)
+{
+	char buffer[32];
+	int  len = format_fixed(buffer, value, precision, NULL);
+
+	if (len < 0) return extract_astring_catf(alloc, string, "%.*f", precision, value);
+	return extract_astring_catl(alloc, string, buffer, len);
+}
+
+int extract_astring_catg(extract_alloc_t *alloc, extract_astring_t *string, double value)
+{
+	/* printf's %g uses exponent notation if the exponent X of the value
+	after rounding to 6 significant figures is less than -4 or at least 6,
+	otherwise it is like %.*f with precision 5-X, with trailing zeros
+	removed. We only handle the latter. */
+	char                buffer[32];
+	unsigned long long  digits;
+	double              a = (value < 0) ? -value : value;
+	int                 x;
+	int                 len;
+	int                 i;
+
+	if (!(a >= 1e-4 && a < 1e5)) goto fallback;
+
+	for (x=-4; x<4; ++x)
+	{
+		if (a < ((x < -1) ? 1.0 / s_pow10[-x-1] : s_pow10[x+1])) break;
+	}
+
+	/* Rounding may change the exponent, and comparisons with inexact
+	powers of ten may have been wrong, so check the number of significant
+	figures we actually got. */
+	for (i=0;; ++i)
+	{
+		if (i == 3 || x < -4 || x > 5) goto fallback;
+		len = format_fixed(buffer, value, 5 - x, &digits);
+		if (len < 0) goto fallback;
+		if (digits >= 1000000) x += 1;
+		else if (digits < 100000) x -= 1;
+		else break;
+	}
+
+	/* Remove trailing zeros and any trailing decimal point. */
+	if (strchr(buffer, '.'))
+	{
+		while (buffer[len-1] == '0') len -= 1;
+		if (buffer[len-1] == '.') len -= 1;
+	}
+
+	return extract_astring_catl(alloc, string, buffer, len);
+
+fallback:
+	return extract_astring_catf(alloc, string, "%g", value);
 }
 
 int extract_astring_truncate(extract_astring_t *content, int len)
@@ -79,119 +257,220 @@ int extract_astring_char_truncate_if(extract_astring_t *content, char c)
 	return 0;
 }
 
-int extract_astring_catc_unicode(extract_alloc_t  *alloc,
-				extract_astring_t *string,
-				int                c,
-				int                xml,
-				int                ascii_ligatures,
-				int                ascii_dash,
-				int                ascii_apostrophe)
+/* Output for ASCII characters when XML escaping; NULL for characters that
+are output verbatim. Characters below 32 other than tab, newline and carriage
+return are illegal in xml (see https://www.w3.org/TR/xml/#charsets), so we
+replace them with 0xfffd, the unicode replacement character. */
+static const char *s_ascii_xml[128] =
 {
-	int ret = -1;
+	"&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;",
+	"&#xfffd;", "&#x9;",    "&#xa;",    "&#xfffd;", "&#xfffd;", "&#xd;",    "&#xfffd;", "&#xfffd;",
+	"&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;",
+	"&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;", "&#xfffd;",
+	NULL, NULL, "&quot;", NULL, NULL, NULL, "&amp;", "&apos;",
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, "&lt;", NULL, "&gt;", NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, "&#x7f;",
+};
 
-	if (0) {}
+/* Length of s_ascii_xml[] entries, or 1 for NULL entries. */
+static const unsigned char s_ascii_xml_len[128] =
+{
+	8, 8, 8, 8, 8, 8, 8, 8,   8, 5, 5, 8, 8, 5, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8,   8, 8, 8, 8, 8, 8, 8, 8,
+	1, 1, 6, 1, 1, 1, 5, 6,   1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,   1, 1, 1, 1, 4, 1, 4, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,   1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,   1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,   1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1,   1, 1, 1, 1, 1, 1, 1, 6,
+};
 
-	/* Escape XML special characters. */
-	else if (xml && c == '<')  extract_astring_cat(alloc, string, "&lt;");
-	else if (xml && c == '>')  extract_astring_cat(alloc, string, "&gt;");
-	else if (xml && c == '&')  extract_astring_cat(alloc, string, "&amp;");
-	else if (xml && c == '"')  extract_astring_cat(alloc, string, "&quot;");
-	else if (xml && c == '\'') extract_astring_cat(alloc, string, "&apos;");
+/* Longest output of unicode_encode(). */
+#define UNICODE_ENCODE_MAX 16
 
-	/* Expand ligatures. */
-	else if (ascii_ligatures && c == 0xFB00)
-	{
-		if (extract_astring_cat(alloc, string, "ff")) goto end;
-	}
-	else if (ascii_ligatures && c == 0xFB01)
-	{
-		if (extract_astring_cat(alloc, string, "fi")) goto end;
-	}
-	else if (ascii_ligatures && c == 0xFB02)
+/* Writes encoding of unicode character <c> to <buffer>, which must have
+space for UNICODE_ENCODE_MAX bytes, and returns number of bytes written.
+Args are as for extract_astring_catc_unicode(). */
+static int unicode_encode(
+		char *buffer,
+		int   c,
+		int   xml,
+		int   ascii_ligatures,
+		int   ascii_dash,
+		int   ascii_apostrophe)
+{
+	/* Escape XML special characters and control characters; output other
+	ASCII verbatim. */
+	if (xml && c >= 0 && c < 128 && s_ascii_xml[c])
 	{
-		if (extract_astring_cat(alloc, string, "fl")) goto end;
+		memcpy(buffer, s_ascii_xml[c], s_ascii_xml_len[c]);
+		return s_ascii_xml_len[c];
 	}
-	else if (ascii_ligatures && c == 0xFB03)
+	if (c >= 32 && c < 127)
 	{
-		if (extract_astring_cat(alloc, string, "ffi")) goto end;
+		buffer[0] = (char) c;
+		return 1;
 	}
-	else if (ascii_ligatures && c == 0xFB04)
+
+	/* Expand ligatures. */
+	if (ascii_ligatures && c >= 0xFB00 && c <= 0xFB04)
 	{
-		if (extract_astring_cat(alloc, string, "ffl")) goto end;
+		static const char *ligatures[] = { "ff", "fi", "fl", "ffi", "ffl" };
+		const char *ligature = ligatures[c - 0xFB00];
+		size_t      len = strlen(ligature);
+		memcpy(buffer, ligature, len);
+		return (int) len;
 	}
 
 	/* Convert some special characters to ascii. */
-	else if (ascii_dash && c == 0x2212)
-	{
-		if (extract_astring_catc(alloc, string, '-')) goto end;
-	}
-	else if (ascii_apostrophe && c == 0x2019)
+	if (ascii_dash && c == 0x2212)
 	{
-		if (extract_astring_catc(alloc, string, '\'')) goto end;
+		buffer[0] = '-';
+		return 1;
 	}
-
-	/* Output ASCII verbatim. */
-	else if (c >= 32 && c < 127)
+	if (ascii_apostrophe && c == 0x2019)
 	{
-		if (extract_astring_catc(alloc, string, (char) c)) goto end;
+		buffer[0] = '\'';
+		return 1;
 	}
 
 	/* Escape all other characters. */
-	else if (xml)
+	if (xml)
 	{
-		char	buffer[32];
 		if (c < 32 && (c != 0x9 && c != 0xa && c != 0xd))
 		{
-			/* Illegal xml character; see
-			https://www.w3.org/TR/xml/#charsets. We replace with
-			0xfffd, the unicode replacement character. */
+			/* Illegal xml character. */
 			c = 0xfffd;
 		}
-		snprintf(buffer, sizeof(buffer), "&#x%x;", c);
-		if (extract_astring_cat(alloc, string, buffer)) goto end;
+		return snprintf(buffer, UNICODE_ENCODE_MAX, "&#x%x;", c);
 	}
-	else
+
+	/* Use utf8. */
+	if (c < 0x80)
 	{
-		/* Use utf8. */
-		if (c < 0x80)
-		{
-			if (extract_astring_catc(alloc, string, (char) c)) return -1;
-		}
-		else if (c < 0x0800)
-		{
-			char cc[2] = {	(char) (((c >> 6) & 0x1f) | 0xc0),
-					(char) (((c >> 0) & 0x3f) | 0x80) };
-			if (extract_astring_catl(alloc, string, cc, sizeof(cc))) return -1;
-		}
-		else if (c < 0x10000)
+		buffer[0] = (char) c;
+		return 1;
+	}
+	if (c < 0x0800)
+	{
+		buffer[0] = (char) (((c >> 6) & 0x1f) | 0xc0);
+		buffer[1] = (char) (((c >> 0) & 0x3f) | 0x80);
+		return 2;
+	}
+	if (c < 0x10000)
+	{
+		buffer[0] = (char) (((c >> 12) & 0x0f) | 0xe0);
+		buffer[1] = (char) (((c >>  6) & 0x3f) | 0x80);
+		buffer[2] = (char) (((c >>  0) & 0x3f) | 0x80);
+		return 3;
+	}
+	if (c < 0x110000)
+	{
+		buffer[0] = (char) (((c >> 18) & 0x07) | 0xf0);
+		buffer[1] = (char) (((c >> 12) & 0x3f) | 0x80);
+		buffer[2] = (char) (((c >>  6) & 0x3f) | 0x80);
+		buffer[3] = (char) (((c >>  0) & 0x3f) | 0x80);
+		return 4;
+	}
+
+	/* Use replacement character. */
+	buffer[0] = (char) 0xef;
+	buffer[1] = (char) 0xbf;
+	buffer[2] = (char) 0xbd;
+	buffer[3] = 0;
+	return 4;
+}
+
+int extract_astring_catc_unicode(extract_alloc_t  *alloc,
+				extract_astring_t *string,
+				int                c,
+				int                xml,
+				int                ascii_ligatures,
+				int                ascii_dash,
+				int                ascii_apostrophe)
+{
+	char buffer[UNICODE_ENCODE_MAX];
+	int  len = unicode_encode(buffer, c, xml, ascii_ligatures, ascii_dash, ascii_apostrophe);
+
+	return extract_astring_catl(alloc, string, buffer, len);
+}
+
+#define UCS(i) (*(const unsigned *) ((const char *) ucs + (i) * stride))
+
+int extract_astring_catl_unicode(
+		extract_alloc_t   *alloc,
+		extract_astring_t *string,
+		const unsigned    *ucs,
+		size_t             stride,
+		int                ucs_num,
+		int                xml,
+		int                ascii_ligatures,
+		int                ascii_dash,
+		int                ascii_apostrophe)
+{
+	char    buffer[UNICODE_ENCODE_MAX];
+	size_t  len = 0;
+	char   *out;
+	int     i;
+
+	if (ucs_num <= 0) return 0;
+
+	/* Find the exact length of the output, so that we need to grow <string>
+	at most once. ASCII characters are looked up in a table; anything else
+	is rare enough that we simply encode it twice. */
+	for (i=0; i<ucs_num; ++i)
+	{
+		unsigned c = UCS(i);
+		if (c < 128)
+			len += xml ? s_ascii_xml_len[c] : 1;
+		else
+			len += unicode_encode(buffer, (int) c, xml, ascii_ligatures, ascii_dash, ascii_apostrophe);
+	}
+
+	if (astring_reserve(alloc, string, len))
+		return -1;
+	/* coverity[deref_parm_field_in_call] */
+	out = string->chars + string->chars_num;
+
+	for (i=0; i<ucs_num; ++i)
+	{
+		unsigned c = UCS(i);
+		if (c < 128 && (!xml || !s_ascii_xml[c]))
 		{
-			char cc[3] = {	(char) (((c >> 12) & 0x0f) | 0xe0),
-					(char) (((c >>  6) & 0x3f) | 0x80),
-					(char) (((c >>  0) & 0x3f) | 0x80) };
-			if (extract_astring_catl(alloc, string, cc, sizeof(cc))) return -1;
+			/* Fast path for plain ASCII. Note that we never escape ASCII
+			when not writing XML. */
+			*out++ = (char) c;
 		}
-		else if (c < 0x110000)
+		else if (c < 128)
 		{
-			char cc[4] = {	(char) (((c >> 18) & 0x07) | 0xf0),
-					(char) (((c >> 12) & 0x3f) | 0x80),
-					(char) (((c >>  6) & 0x3f) | 0x80),
-					(char) (((c >>  0) & 0x3f) | 0x80) };
-			if (extract_astring_catl(alloc, string, cc, sizeof(cc))) return -1;
+			size_t n = s_ascii_xml_len[c];
+			memcpy(out, s_ascii_xml[c], n);
+			out += n;
 		}
 		else
 		{
-			/* Use replacement character. */
-			char cc[4] = { (char) 0xef, (char) 0xbf, (char) 0xbd, 0};
-			if (extract_astring_catl(alloc, string, cc, sizeof(cc))) return -1;
+			int n = unicode_encode(out, (int) c, xml, ascii_ligatures, ascii_dash, ascii_apostrophe);
+			out += n;
 		}
 	}
+	assert(out == string->chars + string->chars_num + len);
+	*out = 0;
+	string->chars_num += len;
 
-	ret = 0;
-
-end:
-	return ret;
+	return 0;
 }
 
+#undef UCS
+
 int extract_astring_catc_unicode_xml(extract_alloc_t *alloc, extract_astring_t *string, int c)
 {
 	/* FIXME: better to use ascii_ligatures=0, but that requires updates to
@@ -206,3 +485,24 @@ int extract_astring_catc_unicode_xml(extract_alloc_t *alloc, extract_astring_t *
 					0 /*ascii_apostrophe*/
 					);
 }
+
+int extract_astring_catl_unicode_xml(
+		extract_alloc_t   *alloc,
+		extract_astring_t *string,
+		const unsigned    *ucs,
+		size_t             stride,
+		int                ucs_num)
+{
+	/* Same flags as extract_astring_catc_unicode_xml(). */
+	return extract_astring_catl_unicode(
+					alloc,
+					string,
+					ucs,
+					stride,
+					ucs_num,
+					1 /*xml*/,
+					1 /*ascii_ligatures*/,
+					0 /*ascii_dash*/,
+					0 /*ascii_apostrophe*/
+					);
+}
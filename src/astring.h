@@ -5,11 +5,15 @@
 
 /* Only for internal use by extract code.  */
 
-/* A simple string struct that reallocs as required. */
+/* A simple string struct that reallocs as required.
+
+Code that takes ownership of .chars must call extract_astring_init()
+afterwards, so that .chars_max is not left stale. */
 typedef struct
 {
 	char   *chars;      /* NULL or zero-terminated. */
 	size_t  chars_num;  /* Length of string pointed to by .chars. */
+	size_t  chars_max;  /* Allocated size of .chars, zero if .chars is NULL. */
 } extract_astring_t;
 
 /* Initialises <string> so it is ready for use. */
@@ -19,13 +23,27 @@ void extract_astring_init(extract_astring_t *string);
 extract_astring_init(). */
 void extract_astring_free(extract_alloc_t *alloc, extract_astring_t *string);
 
+/* Makes <string> empty, keeping its allocated buffer. */
+void extract_astring_clear(extract_astring_t *string);
+
 int extract_astring_catl(extract_alloc_t *alloc, extract_astring_t *string, const char *s, size_t s_len);
 
 int extract_astring_catc(extract_alloc_t *alloc, extract_astring_t *string, char c);
 
 int extract_astring_cat(extract_alloc_t *alloc, extract_astring_t *string, const char *s);
+
+/* Appends printf-style formatted text. Writes directly into spare capacity in
+<string>, so usually does not need to allocate. */
 int extract_astring_catf(extract_alloc_t *alloc, extract_astring_t *string, const char *format, ...);
 
+/* Appends <value> formatted as by printf("%.*f", precision, value), using a
+fast path that avoids printf for most values. */
+int extract_astring_catd(extract_alloc_t *alloc, extract_astring_t *string, double value, int precision);
+
+/* Appends <value> formatted as by printf("%g", value), using a fast path that
+avoids printf for most values. */
+int extract_astring_catg(extract_alloc_t *alloc, extract_astring_t *string, double value);
+
 /* Removes last <len> chars. */
 int extract_astring_truncate(extract_astring_t *content, int len);
 
@@ -57,4 +75,29 @@ int extract_astring_catc_unicode(extract_alloc_t   *alloc,
 /* Appends specific unicode character, using XML escape sequences as required. */
 int extract_astring_catc_unicode_xml(extract_alloc_t *alloc, extract_astring_t *string, int c);
 
+/* Appends <ucs_num> unicode characters to <string>, encoded as by
+extract_astring_catc_unicode(), growing <string> only once.
+
+Characters are read from <ucs>, with <stride> bytes between consecutive
+characters, so one can pass &span->chars[0].ucs and sizeof(char_t). */
+int extract_astring_catl_unicode(
+		extract_alloc_t   *alloc,
+		extract_astring_t *string,
+		const unsigned    *ucs,
+		size_t             stride,
+		int                ucs_num,
+		int                xml,
+		int                ascii_ligatures,
+		int                ascii_dash,
+		int                ascii_apostrophe);
+
+/* Appends <ucs_num> unicode characters, encoded as by
+extract_astring_catc_unicode_xml(). */
+int extract_astring_catl_unicode_xml(
+		extract_alloc_t   *alloc,
+		extract_astring_t *string,
+		const unsigned    *ucs,
+		size_t             stride,
+		int                ucs_num);
+
 #endif
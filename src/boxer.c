@@ -358,39 +358,63 @@ boxer_subdivide(boxer_t *boxer, boxer_t **boxer1, boxer_t **boxer2)
 
 
 /* Extract specifics */
-static rect_t
-extract_span_bbox(span_t *span)
+/* A span and its bbox, which we calculate only once. */
+typedef struct
 {
-	int j;
-	rect_t bbox = extract_rect_empty;
+	span_t *span;
+	rect_t  bbox;
+} span_bbox_t;
+
+static int
+span_bbox_inside(const span_bbox_t *span_bbox, rect_t rect)
+{
+	return span_bbox->bbox.min.x >= rect.min.x
+			&& span_bbox->bbox.min.y >= rect.min.y
+			&& span_bbox->bbox.max.x <= rect.max.x
+			&& span_bbox->bbox.max.y <= rect.max.y;
+}
 
-	for (j = 0; j < span->chars_num; j++)
+/* Moves the items in spans[] that are inside <rect> to the start of spans[],
+preserving their order, and returns the number of them. The order of the
+remaining items is also preserved. <scratch> must have space for <spans_num>
+items. */
+static int
+span_bboxes_partition(span_bbox_t *spans, int spans_num, rect_t rect, span_bbox_t *scratch)
+{
+	int inside = 0;
+	int outside = 0;
+	int i;
+
+	for (i = 0; i < spans_num; i++)
 	{
-		char_t *char_ = &span->chars[j];
-		bbox = extract_rect_union(bbox, char_->bbox);
+		if (span_bbox_inside(&spans[i], rect))
+			spans[inside++] = spans[i];
+		else
+			scratch[outside++] = spans[i];
 	}
-	return bbox;
-}
+	if (outside)
+		memcpy(spans + inside, scratch, sizeof(*spans) * outside);
 
+	return inside;
+}
 
+/* Creates a new subpage for a leaf and moves into it the spans in spans[]
+that are inside <mediabox>. */
 static int
-extract_subpage_subset(extract_alloc_t *alloc, extract_page_t *page, subpage_t *subpage, rect_t mediabox)
+extract_subpage_subset(extract_alloc_t *alloc, extract_page_t *page, span_bbox_t *spans, int spans_num, rect_t mediabox)
 {
-	content_span_iterator  sit;
-	span_t                *span;
-	subpage_t             *target;
+	subpage_t *target;
+	int        i;
 
 	if (extract_subpage_alloc(alloc, mediabox, page, &target))
 	return -1;
 
-	for (span = content_span_iterator_init(&sit, &subpage->content); span != NULL; span = content_span_iterator_next(&sit))
+	for (i = 0; i < spans_num; i++)
 	{
-		rect_t bbox = extract_span_bbox(span);
-
-		if (bbox.min.x >= mediabox.min.x && bbox.min.y >= mediabox.min.y && bbox.max.x <= mediabox.max.x && bbox.max.y <= mediabox.max.y)
+		if (span_bbox_inside(&spans[i], mediabox))
 		{
-			content_unlink(&span->base);
-			content_append_span(&target->content, span);
+			content_unlink(&spans[i].span->base);
+			content_append_span(&target->content, spans[i].span);
 		}
 	}
 
@@ -401,8 +425,24 @@ enum {
 	MAX_ANALYSIS_DEPTH = 6
 };
 
+/* Leaf subpages are created in depth-first order, and each span goes into the
+first leaf whose mediabox contains it. Each leaf's mediabox is inside the
+mediaboxes of all the boxers above it, and sibling boxers do not overlap, so
+rather than checking every span against every leaf, we pass down only the
+spans that are inside the current boxer.
+
+spans[] is reordered; scratch[] is working space with room for as many items
+as spans[]. Once <deadline> has passed we do not subdivide any further. */
 static int
-analyse_sub(extract_page_t *page, subpage_t *subpage, boxer_t *big_boxer, split_t **psplit, int depth)
+analyse_sub(
+		extract_page_t *page,
+		boxer_t        *big_boxer,
+		split_t       **psplit,
+		int             depth,
+		span_bbox_t    *spans,
+		int             spans_num,
+		span_bbox_t    *scratch,
+		deadline_t     *deadline)
 {
 	rect_t margins;
 	boxer_t *boxer;
@@ -411,6 +451,8 @@ analyse_sub(extract_page_t *page, subpage_t *subpage, boxer_t *big_boxer, split_
 	int ret;
 	split_type_t split_type;
 	split_t *split;
+	int spans1_num;
+	int spans2_num;
 
 	margins = boxer_margins(big_boxer);
 #ifdef DEBUG_WRITE_AS_PS
@@ -420,6 +462,7 @@ analyse_sub(extract_page_t *page, subpage_t *subpage, boxer_t *big_boxer, split_
 	boxer = boxer_subset(big_boxer, margins);
 
 	if (depth < MAX_ANALYSIS_DEPTH &&
+		!extract_deadline_passed(deadline) &&
 		(split_type = boxer_subdivide(boxer, &boxer1, &boxer2)) != SPLIT_NONE)
 	{
 		if (boxer1 == NULL || boxer2 == NULL ||
@@ -430,8 +473,10 @@ analyse_sub(extract_page_t *page, subpage_t *subpage, boxer_t *big_boxer, split_
 		}
 		split = *psplit;
 		outf("depth=%d %s\n", depth, split_type == SPLIT_HORIZONTAL ? "H" : "V");
-		ret = analyse_sub(page, subpage, boxer1, &split->split[0], depth+1);
-		if (!ret) ret = analyse_sub(page, subpage, boxer2, &split->split[1], depth+1);
+		spans1_num = span_bboxes_partition(spans, spans_num, boxer1->mediabox, scratch);
+		spans2_num = span_bboxes_partition(spans + spans1_num, spans_num - spans1_num, boxer2->mediabox, scratch);
+		ret = analyse_sub(page, boxer1, &split->split[0], depth+1, spans, spans1_num, scratch, deadline);
+		if (!ret) ret = analyse_sub(page, boxer2, &split->split[1], depth+1, spans + spans1_num, spans2_num, scratch, deadline);
 		if (!ret)
 		{
 			if (split_type == SPLIT_HORIZONTAL)
@@ -461,7 +506,7 @@ fail_mid_split:
 	}
 	split = *psplit;
 
-	ret = extract_subpage_subset(boxer->alloc, page, subpage, boxer->mediabox);
+	ret = extract_subpage_subset(boxer->alloc, page, spans, spans_num, boxer->mediabox);
 
 #ifdef DEBUG_WRITE_AS_PS
 	{
@@ -560,36 +605,77 @@ collate_splits(extract_alloc_t *alloc, split_t **psplit)
 	return 0;
 }
 
-int extract_page_analyse(extract_alloc_t *alloc, extract_page_t *page)
+/* Moves images from <subpage> into the page's first subpage, so that they
+are not lost when <subpage> is freed. Images are not placed by the analysis,
+and image_t's are also referenced by extract_t's table of unique images. */
+static void
+subpage_move_images(extract_page_t *page, subpage_t *subpage)
+{
+	content_image_iterator  iit;
+	image_t                *image;
+
+	if (page->subpages_num == 0) return;
+
+	for (image = content_image_iterator_init(&iit, &subpage->content); image != NULL; image = content_image_iterator_next(&iit))
+	{
+		content_unlink(&image->base);
+		content_append(&page->subpages[0]->content, &image->base);
+		subpage->images_num -= 1;
+		page->subpages[0]->images_num += 1;
+	}
+}
+
+int extract_page_analyse(extract_alloc_t *alloc, extract_page_t *page, deadline_t *deadline)
 {
 	boxer_t               *boxer;
 	subpage_t             *subpage = page->subpages[0];
 	content_span_iterator  sit;
 	span_t                *span;
+	span_bbox_t           *spans = NULL;
+	span_bbox_t           *scratch = NULL;
+	int                    spans_num = 0;
+	int                    spans_max = 0;
+	int                    ret = -1;
 
 	/* This code will only work if the page contains a single subpage.
 	* This should always be the case if we're called from a page
 	* generated via extract_page_begin. */
 	if (page->subpages_num != 1) return 0;
 
-	/* Take the old subpages out from the page. */
-	page->subpages_num = 0;
-	extract_free(alloc, &page->subpages);
-
 #ifdef DEBUG_WRITE_AS_PS
     fz_info(NULL, "1 -1 scale 0 -%g translate\n", page->mediabox.max.y-page->mediabox.min.y);
 #endif
 
 	boxer = boxer_create(alloc, (rect_t *)&subpage->mediabox);
 
+	for (span = content_span_iterator_init(&sit, &subpage->content); span != NULL; span = content_span_iterator_next(&sit))
+		spans_max += 1;
+	if (extract_malloc(alloc, &spans, sizeof(*spans) * spans_max)
+			|| extract_malloc(alloc, &scratch, sizeof(*scratch) * spans_max))
+		goto fail_early;
+
 	for (span = content_span_iterator_init(&sit, &subpage->content); span != NULL; span = content_span_iterator_next(&sit))
 	{
 		rect_t bbox = extract_span_bbox(span);
+		spans[spans_num].span = span;
+		spans[spans_num].bbox = bbox;
+		spans_num += 1;
 		if (boxer_feed(boxer, &bbox))
-			goto fail;
+			goto fail_early;
+		if (extract_deadline_passed(deadline))
+		{
+			/* Leave the page as a single subpage. */
+			outf("deadline passed, abandoning analysis.");
+			ret = 0;
+			goto fail_early;
+		}
 	}
 
-	if (analyse_sub(page, subpage, boxer, &page->split, 0))
+	/* Take the old subpages out from the page. */
+	page->subpages_num = 0;
+	extract_free(alloc, &page->subpages);
+
+	if (analyse_sub(page, boxer, &page->split, 0, spans, spans_num, scratch, deadline))
 		goto fail;
 
 	if (collate_splits(boxer->alloc, &page->split))
@@ -600,13 +686,28 @@ int extract_page_analyse(extract_alloc_t *alloc, extract_page_t *page)
 #endif
 
 	boxer_destroy(boxer);
+	extract_free(alloc, &spans);
+	extract_free(alloc, &scratch);
+	subpage_move_images(page, subpage);
 	extract_subpage_free(alloc, &subpage);
 
 	return 0;
 
+fail_early:
+	/* The page still has its original subpage. */
+	if (ret) outf("Analysis failed!\n");
+	boxer_destroy(boxer);
+	extract_free(alloc, &spans);
+	extract_free(alloc, &scratch);
+
+	return ret;
+
 fail:
 	outf("Analysis failed!\n");
 	boxer_destroy(boxer);
+	extract_free(alloc, &spans);
+	extract_free(alloc, &scratch);
+	subpage_move_images(page, subpage);
 	extract_subpage_free(alloc, &subpage);
 
 	return -1;
@@ -229,6 +229,52 @@ static void test_write(void)
     outf("Write test passed.\n");
 }
 
+static int s_write_fail(void* handle, const void* source, size_t bytes, size_t* o_actual)
+/* Always fails. */
+{
+    (void) handle;
+    (void) source;
+    (void) bytes;
+    *o_actual = 0;
+    errno = EIO;
+    return -1;
+}
+
+static void s_close_count(void* handle)
+{
+    int* num_calls_close = handle;
+    *num_calls_close += 1;
+}
+
+static int s_fail_cache(void* handle, void** o_cache, size_t* o_numbytes)
+{
+    static char cache[16];
+    (void) handle;
+    *o_cache = cache;
+    *o_numbytes = sizeof(cache);
+    return 0;
+}
+
+static void test_close_error(void)
+/* Check that extract_buffer_close() still calls fn_close() if flushing the
+cache fails. */
+{
+    extract_buffer_t* buffer;
+    int num_calls_close = 0;
+    size_t actual;
+    int e;
+
+    e = extract_buffer_open(NULL /*alloc*/, &num_calls_close, NULL /*read*/, s_write_fail, s_fail_cache, s_close_count, &buffer);
+    assert(!e);
+    e = extract_buffer_write(buffer, "abc", 3, &actual);
+    assert(!e && actual == 3);
+    e = extract_buffer_close(&buffer);
+    assert(e);
+    assert(buffer == NULL);
+    assert(num_calls_close == 1);
+    outf("Close error test passed.\n");
+}
+
 static void test_file(void)
 {
     /* Check we can write 3 bytes to file. */
@@ -293,6 +339,37 @@ static void test_file(void)
         if (extract_buffer_close(&file_buffer)) abort();
     }
 
+    /* Check a mixture of small and large writes and reads with small
+    cache blocks. */
+    {
+        char    data[1000];
+        char    buffer[1000];
+        size_t  i;
+        size_t  pos;
+        size_t  n;
+        for (i=0; i<sizeof(data); ++i) data[i] = (char) (i * 7 + i / 13);
+        if (extract_buffer_open_file2(NULL /*alloc*/, "test/generated/buffer-file", 1 /*writable*/, 16 /*block_size*/, &file_buffer)) abort();
+        for (pos=0, i=0; pos < sizeof(data); pos += n, ++i)
+        {
+            n = (i % 5 == 4) ? 41 : i % 5;
+            if (n > sizeof(data) - pos) n = sizeof(data) - pos;
+            if (extract_buffer_write(file_buffer, data + pos, n, NULL)) abort();
+        }
+        if (extract_buffer_pos(file_buffer) != sizeof(data)) abort();
+        if (extract_buffer_close(&file_buffer)) abort();
+
+        if (extract_buffer_open_file2(NULL /*alloc*/, "test/generated/buffer-file", 0 /*writable*/, 23 /*block_size*/, &file_buffer)) abort();
+        for (pos=0, i=0; pos < sizeof(data); pos += n, ++i)
+        {
+            n = (i % 3 == 2) ? 37 : i % 3 + 1;
+            if (n > sizeof(data) - pos) n = sizeof(data) - pos;
+            if (extract_buffer_read(file_buffer, buffer + pos, n, NULL)) abort();
+        }
+        if (memcmp(data, buffer, sizeof(data))) abort();
+        if (extract_buffer_read(file_buffer, buffer, 1, &n) != 1 || n != 0) abort();
+        if (extract_buffer_close(&file_buffer)) abort();
+    }
+
     outf("file buffer tests passed.\n");
 }
 
@@ -306,6 +383,7 @@ int main(void)
     extract_outf_verbose_set(1);
     test_read();
     test_write();
+    test_close_error();
     test_file();
     return 0;
 }
@@ -143,11 +143,16 @@ int extract_buffer_close(extract_buffer_t **p_buffer)
 		}
 	}
 
-	if (buffer->fn_close)
-		buffer->fn_close(buffer->handle);
-
 	e = 0;
 end:
+	/* Close the underlying handle even if the flush failed, otherwise it
+	would be leaked. */
+	if (buffer->fn_close)
+	{
+		int errno_save = errno;
+		buffer->fn_close(buffer->handle);
+		errno = errno_save;
+	}
 	extract_free(buffer->alloc, &buffer);
 	*p_buffer = NULL;
 
@@ -193,18 +198,32 @@ int extract_buffer_open_simple(extract_alloc_t           *alloc,
 }
 
 
-/* Implementation of extract_buffer_file*. */
+/* Implementation of extract_buffer_file*.
+
+We turn off stdio's own buffering and instead give extract_buffer a large
+cache block, so that the many small reads and writes made by our callers are
+satisfied inline, and the file sees a small number of large fread()/fwrite()
+calls, each of which becomes a single read(2)/write(2). */
+
+typedef struct
+{
+	extract_alloc_t *alloc;
+	FILE            *file;
+	int              writable;
+	char            *block;
+	size_t           block_size;
+} file_t;
 
 static int file_read(void *handle, void *data, size_t numbytes, size_t *o_actual)
 {
-	FILE   *file = handle;
-	size_t  n    = fread(data, 1, numbytes, file);
+	file_t *file = handle;
+	size_t  n    = fread(data, 1, numbytes, file->file);
 
 	outfx("file=%p numbytes=%i => n=%zi", file, numbytes, n);
 	assert(o_actual); /* We are called by other extract_buffer fns, not by user code. */
 
 	*o_actual = n;
-	if (n == 0 && ferror(file))
+	if (n == 0 && ferror(file->file))
 	{
 		errno = EIO;
 		return -1;
@@ -215,14 +234,14 @@ static int file_read(void *handle, void *data, size_t numbytes, size_t *o_actual
 
 static int file_write(void *handle, const void *data, size_t numbytes, size_t *o_actual)
 {
-	FILE   *file = handle;
-	size_t  n    = fwrite(data, 1 /*size*/, numbytes /*nmemb*/, file);
+	file_t *file = handle;
+	size_t  n    = fwrite(data, 1 /*size*/, numbytes /*nmemb*/, file->file);
 
 	outfx("file=%p numbytes=%i => n=%zi", file, numbytes, n);
 	assert(o_actual); /* We are called by other extract_buffer fns, not by user code. */
 
 	*o_actual = n;
-	if (n == 0 && ferror(file))
+	if (n == 0 && ferror(file->file))
 	{
 		errno = EIO;
 		return -1;
@@ -231,30 +250,68 @@ static int file_write(void *handle, const void *data, size_t numbytes, size_t *o
 	return 0;
 }
 
+static int file_cache(void *handle, void **o_cache, size_t *o_numbytes)
+{
+	file_t *file = handle;
+
+	if (!file->block)
+	{
+		if (extract_malloc(file->alloc, &file->block, file->block_size)) return -1;
+	}
+
+	if (file->writable)
+	{
+		/* Any previous contents have already been passed to file_write(). */
+		*o_cache = file->block;
+		*o_numbytes = file->block_size;
+		return 0;
+	}
+
+	*o_cache = file->block;
+	return file_read(file, file->block, file->block_size, o_numbytes);
+}
+
 static void file_close(void *handle)
 {
-	FILE *file = handle;
+	file_t *file = handle;
 
-	if (file)
-		fclose(file);
+	if (file->file)
+		fclose(file->file);
+	extract_free(file->alloc, &file->block);
+	extract_free(file->alloc, &file);
 }
 
-int extract_buffer_open_file(extract_alloc_t *alloc, const char *path, int writable, extract_buffer_t **o_buffer)
+int extract_buffer_open_file2(
+		extract_alloc_t   *alloc,
+		const char        *path,
+		int                writable,
+		size_t             block_size,
+		extract_buffer_t **o_buffer)
 {
-	int   e    = -1;
-	FILE *file = fopen(path, (writable) ? "wb" : "rb");
+	int     e    = -1;
+	file_t *file = NULL;
+
+	if (extract_malloc(alloc, &file, sizeof(*file))) goto end;
+	file->alloc = alloc;
+	file->writable = writable;
+	file->block = NULL;
+	file->block_size = block_size ? block_size : extract_buffer_file_BLOCK_SIZE;
+	file->file = fopen(path, (writable) ? "wb" : "rb");
 
-	if (!file)
+	if (!file->file)
 	{
 		outf("failed to open '%s': %s", path, strerror(errno));
 		goto end;
 	}
+	/* Our cache does the buffering, so make stdio pass each call straight
+	through to the OS. */
+	setvbuf(file->file, NULL, _IONBF, 0);
 
 	if (extract_buffer_open(alloc,
 				file /*handle*/,
 				writable ? NULL : file_read,
 				writable ? file_write : NULL,
-				NULL /*fn_cache*/,
+				file_cache,
 				file_close,
 				o_buffer)) goto end;
 
@@ -264,13 +321,18 @@ end:
 	if (e)
 	{
 		if (file)
-			fclose(file);
+			file_close(file);
 		*o_buffer = NULL;
 	}
 
 	return e;
 }
 
+int extract_buffer_open_file(extract_alloc_t *alloc, const char *path, int writable, extract_buffer_t **o_buffer)
+{
+	return extract_buffer_open_file2(alloc, path, writable, 0 /*block_size*/, o_buffer);
+}
+
 
 /* Support for read/write. */
 
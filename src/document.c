@@ -1,4 +1,5 @@
 #include "document.h"
+#include "mem.h"
 #include "outf.h"
 #include <assert.h>
 #include <stdio.h>
@@ -53,6 +54,7 @@ void extract_span_init(span_t *span, structure_t *structure)
 	*span = blank;
 	content_init(&span->base, content_span);
 	span->structure = structure;
+	span->bbox_chars_num = -1;
 }
 
 void extract_span_free(extract_alloc_t *alloc, span_t **pspan)
@@ -61,9 +63,8 @@ void extract_span_free(extract_alloc_t *alloc, span_t **pspan)
 		return;
 
 	content_unlink(&(*pspan)->base);
-	extract_free(alloc, &(*pspan)->font_name);
 	extract_free(alloc, &(*pspan)->chars);
-	extract_free(alloc, pspan);
+	extract_free_pooled(alloc, pspan, sizeof(**pspan));
 }
 
 void extract_line_init(line_t *line)
@@ -333,7 +334,7 @@ void extract_line_free(extract_alloc_t* alloc, line_t **pline)
 
 	content_unlink(&line->base);
 	content_clear(alloc, &line->content);
-	extract_free(alloc, pline);
+	extract_free_pooled(alloc, pline, sizeof(**pline));
 }
 
 void extract_image_clear(extract_alloc_t *alloc, image_t *image)
@@ -370,6 +371,136 @@ void extract_cell_free(extract_alloc_t *alloc, cell_t **pcell)
 	extract_free(alloc, pcell);
 }
 
+void extract_fonts_init(fonts_t *fonts)
+{
+	fonts->fonts = NULL;
+	fonts->fonts_num = 0;
+	fonts->fonts_max = 0;
+	fonts->hash = NULL;
+	fonts->hash_num = 0;
+}
+
+void extract_fonts_free(extract_alloc_t *alloc, fonts_t *fonts)
+{
+	int i;
+
+	for (i=0; i<fonts->fonts_num; ++i)
+		extract_free(alloc, &fonts->fonts[i].name);
+	extract_free(alloc, &fonts->fonts);
+	extract_free(alloc, &fonts->hash);
+	extract_fonts_init(fonts);
+}
+
+void extract_fonts_clear(extract_alloc_t *alloc, fonts_t *fonts)
+{
+	int i;
+
+	for (i=0; i<fonts->fonts_num; ++i)
+		extract_free(alloc, &fonts->fonts[i].name);
+	fonts->fonts_num = 0;
+	for (i=0; i<fonts->hash_num; ++i)
+		fonts->hash[i] = -1;
+}
+
+static unsigned fonts_hash(const char *name, int bold, int italic)
+{
+	unsigned char flags = (unsigned char) ((bold ? 1 : 0) | (italic ? 2 : 0));
+
+	return extract_hash(extract_hash(extract_hash_START, name, strlen(name)), &flags, 1);
+}
+
+/* Returns index of hash slot that contains the font, or of the empty slot
+where it should go. fonts->hash_num must be non-zero. */
+static int fonts_hash_find(fonts_t *fonts, const char *name, int bold, int italic)
+{
+	unsigned mask = (unsigned) fonts->hash_num - 1;
+	unsigned i = fonts_hash(name, bold, italic) & mask;
+
+	for (;;)
+	{
+		int           id = fonts->hash[i];
+		font_entry_t *font;
+
+		if (id < 0) return (int) i;
+		font = &fonts->fonts[id];
+		if (font->bold == bold && font->italic == italic && !strcmp(font->name, name))
+			return (int) i;
+		i = (i + 1) & mask;
+	}
+}
+
+/* Resizes the hash to have <hash_num> slots and re-inserts all fonts. */
+static int fonts_rehash(extract_alloc_t *alloc, fonts_t *fonts, int hash_num)
+{
+	int i;
+
+	extract_free(alloc, &fonts->hash);
+	if (extract_malloc(alloc, &fonts->hash, sizeof(*fonts->hash) * hash_num))
+	{
+		fonts->hash_num = 0;
+		return -1;
+	}
+	fonts->hash_num = hash_num;
+	for (i=0; i<hash_num; ++i)
+		fonts->hash[i] = -1;
+	for (i=0; i<fonts->fonts_num; ++i)
+	{
+		font_entry_t *font = &fonts->fonts[i];
+		fonts->hash[fonts_hash_find(fonts, font->name, font->bold, font->italic)] = i;
+	}
+
+	return 0;
+}
+
+int extract_fonts_intern(
+		extract_alloc_t *alloc,
+		fonts_t         *fonts,
+		const char      *name,
+		int              bold,
+		int              italic,
+		int             *o_id)
+{
+	int           slot;
+	font_entry_t *font;
+
+	bold = bold ? 1 : 0;
+	italic = italic ? 1 : 0;
+
+	/* Keep load factor at most 1/2. */
+	if ((fonts->fonts_num + 1) * 2 > fonts->hash_num)
+	{
+		if (fonts_rehash(alloc, fonts, fonts->hash_num ? fonts->hash_num * 2 : 64)) return -1;
+	}
+
+	slot = fonts_hash_find(fonts, name, bold, italic);
+	if (fonts->hash[slot] >= 0)
+	{
+		*o_id = fonts->hash[slot];
+		return 0;
+	}
+
+	if (fonts->fonts_num == fonts->fonts_max)
+	{
+		int fonts_max = fonts->fonts_max ? fonts->fonts_max * 2 : 32;
+		if (extract_realloc2(
+				alloc,
+				&fonts->fonts,
+				sizeof(*fonts->fonts) * fonts->fonts_max,
+				sizeof(*fonts->fonts) * fonts_max
+				)) return -1;
+		fonts->fonts_max = fonts_max;
+	}
+	font = &fonts->fonts[fonts->fonts_num];
+	if (extract_strdup(alloc, name, &font->name)) return -1;
+	font->bold = bold;
+	font->italic = italic;
+	fonts->hash[slot] = fonts->fonts_num;
+	*o_id = fonts->fonts_num;
+	fonts->fonts_num += 1;
+
+	return 0;
+}
+
 int
 extract_split_alloc(extract_alloc_t *alloc, split_type_t type, int count, split_t **psplit)
 {
@@ -639,86 +770,89 @@ void content_dump_brief(const content_root_t *content)
 	content_dump_brief_aux(content, 0);
 }
 
-static content_t *
-cmp_and_merge(content_t *q1, int q1pos, int len1, int n, content_cmp_fn *cmp)
+typedef struct
 {
-	int len2 = q1pos + len1*2; /* end of both lists assuming we don't overrun */
-	int p;
-	content_t *q2 = q1;
-
-	/* Don't overrun the end, and then convert to length from end. */
-	if (len2 > n)
-		len2 = n;
-	len2 -= q1pos + len1;
+	content_t          *content;
+	int                 has_key;
+	content_sort_key_t  key;
+} sort_item_t;
 
-	if (len2 <= 0)
-		len1 += len2;
+static int
+sort_item_cmp(const sort_item_t *a, const sort_item_t *b)
+{
+	if (!a->has_key || !b->has_key)   return 0;
+	if (a->key.major != b->key.major) return (a->key.major > b->key.major) ? 1 : -1;
+	if (a->key.minor != b->key.minor) return (a->key.minor > b->key.minor) ? 1 : -1;
 
-	/* Find the start of q2. We know this fits. */
-	for (p = 0; p < len1; p++)
-		q2 = q2->next;
+	return 0;
+}
 
-	if (len2 <= 0)
-		return q2;
+int content_sort(extract_alloc_t *alloc, content_root_t *content, content_key_fn *key_fn)
+{
+	int          n = content_count(content);
+	sort_item_t *items = NULL;
+	sort_item_t *scratch = NULL;
+	content_t   *prev;
+	int          size;
+	int          i;
 
-	/* So we have [q1..(q1+len1)) as the first list to merge, and
-	 * [q2..q2+len2)) as the second list to merge. We know that
-	 * q2 = q1+len1. So, if we can reduce len1 or len2 to 0, we have
-	 * the lists sorted. */
-	while (1)
+	if (n < 2) return 0;
+	if (extract_malloc(alloc, &items, sizeof(*items) * n)
+			|| extract_malloc(alloc, &scratch, sizeof(*scratch) * n))
 	{
-		if (cmp(q1, q2) > 0)
-		{
-			/* q2 is smaller. q2 should be before q1. Move it. */
-			/* So:
-			*    a<->q1<->c..d<->q2<->b  =>  a<->q2<->q1<->c..d<->b
-			* (where c and d can either be the same, or can be q2 and q1!)
-			*/
-			content_t *a = q1->prev;
-			content_t *b = q2->next;
-			content_t *d = q2->prev;
-			d->next = b;
-			b->prev = d;
-			a->next = q2;
-			q2->prev = a;
-			q2->next = q1;
-			q1->prev = q2;
-			/* Now advance q2 */
-			q2 = b;
-			len2--;
-			if (len2 == 0)
-				break;
-		} else {
-			/* Advance q1 */
-			q1 = q1->next;
-			len1--;
-			if (len1 == 0)
-				break;
-		}
+		extract_free(alloc, &items);
+		return -1;
 	}
 
-	while (len2)
+	for (i = 0, prev = content->base.next; i < n; i++, prev = prev->next)
 	{
-		q2 = q2->next;
-		len2--;
+		items[i].content = prev;
+		items[i].has_key = key_fn(prev, &items[i].key);
 	}
 
-	return q2;
-}
+	/* Merge adjacent runs of <size> items from items[] into scratch[], taking
+	from the second run only if it is strictly smaller, then swap. */
+	for (size = 1; size < n; size <<= 1)
+	{
+		int lo;
+		sort_item_t *t;
 
-/* Spiffy in-place merge sort. */
-void content_sort(content_root_t *content, content_cmp_fn *cmp)
-{
-	int n = content_count(content);
-	int size;
+		for (lo = 0; lo < n; lo += size*2)
+		{
+			int mid = (lo + size < n) ? lo + size : n;
+			int hi = (lo + size*2 < n) ? lo + size*2 : n;
+			int p = lo;
+			int q = mid;
+			int o = lo;
 
-	for (size = 1; size < n; size <<= 1)
+			while (p < mid && q < hi)
+			{
+				if (sort_item_cmp(&items[p], &items[q]) > 0)
+					scratch[o++] = items[q++];
+				else
+					scratch[o++] = items[p++];
+			}
+			while (p < mid) scratch[o++] = items[p++];
+			while (q < hi)  scratch[o++] = items[q++];
+		}
+		t = items;
+		items = scratch;
+		scratch = t;
+	}
+
+	/* Relink the list in sorted order. */
+	prev = &content->base;
+	for (i = 0; i < n; i++)
 	{
-		int q1_idx = 0;
-		content_t *q1 = content->base.next;
-		for (q1_idx = 0; q1_idx < n; q1_idx += size*2)
-			q1 = cmp_and_merge(q1, q1_idx, size, n, cmp);
-		assert(q1->type == content_root);
+		prev->next = items[i].content;
+		items[i].content->prev = prev;
+		prev = items[i].content;
 	}
-	assert(content_count(content) == n);
+	prev->next = &content->base;
+	content->base.prev = prev;
+
+	extract_free(alloc, &items);
+	extract_free(alloc, &scratch);
+
+	return 0;
 }
@@ -5,6 +5,7 @@
 #include "extract/alloc.h"
 
 #include "compat_stdint.h"
+#include "sys.h"
 #include <assert.h>
 
 typedef struct span_t span_t;
@@ -140,9 +141,22 @@ void content_dump_span(const span_t *span);
 void content_dump_brief(const content_root_t *content);
 
 
-typedef int (content_cmp_fn)(const content_t *, const content_t *);
+/* Sort key used by content_sort(); items are ordered by <major> and then by
+<minor>. */
+typedef struct
+{
+	int     major;
+	double  minor;
+} content_sort_key_t;
+
+/* Sets *o_key to the sort key for <content> and returns 1, or returns 0 if
+<content> has no key, in which case it compares equal to all other items. */
+typedef int (content_key_fn)(const content_t *content, content_sort_key_t *o_key);
 
-void content_sort(content_root_t *content, content_cmp_fn *cmp);
+/* Stable bottom-up merge sort of the items in <content>. Each item's key is
+calculated just once, and the sort itself is done on an array before the
+list is relinked. */
+int content_sort(extract_alloc_t *alloc, content_root_t *content, content_key_fn *key_fn);
 
 /* To iterate over the line elements of a content list:
 
@@ -385,24 +399,55 @@ matrix4_t   extract_multiply_matrix4_matrix4(matrix4_t m1, matrix4_t m2);
 +/-1. */
 int extract_matrix4_cmp(const matrix4_t *lhs, const matrix4_t *rhs);
 
+/* Type of the coordinates stored in char_t. Building with
+EXTRACT_COMPACT_CHARS defined stores them as floats, which halves the size of
+char_t at the cost of precision for very large page coordinates. */
+#ifdef EXTRACT_COMPACT_CHARS
+	typedef float char_coord_t;
+#else
+	typedef double char_coord_t;
+#endif
+
+/* Bounding box of a char; use extract_char_bbox() to get it as a rect_t. */
+typedef struct
+{
+	char_coord_t    min_x;
+	char_coord_t    min_y;
+	char_coord_t    max_x;
+	char_coord_t    max_y;
+} char_bbox_t;
+
 /* A single char in a span. */
 typedef struct
 {
 	/* (x,y) after transformation by ctm. */
-	double      x;
-	double      y;
+	char_coord_t    x;
+	char_coord_t    y;
 
-	unsigned    ucs;
-	double      adv; /* Advance, before transform by ctm */
+	unsigned        ucs;
+	char_coord_t    adv; /* Advance, before transform by ctm */
 
-	rect_t      bbox;
+	char_bbox_t     bbox;
 } char_t;
 
+/* Returns bbox of <char_>. */
+rect_t extract_char_bbox(const char_t *char_);
+
+/* Sets position and bbox of <char_>. */
+void extract_char_set(char_t *char_, double x, double y, double adv, rect_t bbox);
+
 /* List of chars that have same font and are usually adjacent. */
 struct span_t
 {
 	content_t    base;
 	matrix4_t    ctm;
+
+	/* Index into document_t::fonts; spans with the same font name and
+	bold/italic flags have the same font_id. */
+	int          font_id;
+
+	/* Interned copy of the font name owned by document_t::fonts, so not
+	freed with the span. */
 	char        *font_name;
 	rect_t       font_bbox;
 	structure_t *structure;
@@ -415,10 +460,45 @@ struct span_t
 
 	char_t     *chars;
 	int         chars_num;
+
+	/* Direction of advance, (1, 0) or (0, 1) depending on flags.wmode,
+	transformed by ctm, and its squared length. Set by
+	extract_span_geometry_init() once ctm and flags.wmode are known. */
+	point_t     dir;
+	double      scale_squared;
+
+	/* Direction of <dir> quantised to one of extract_span_ROTATION_CLASSES
+	angles, or -1 if <dir> is degenerate. Spans with the same wmode and
+	rotation_class have parallel baselines. Set by
+	extract_span_geometry_init(). */
+	int         rotation_class;
+
+	/* Union of chars[].bbox, cached by extract_span_bbox(). Only valid if
+	bbox_chars_num == chars_num. extract_span_append_c() sets bbox_chars_num
+	to -1; other code that modifies chars[] without changing chars_num must
+	do the same. */
+	rect_t      bbox;
+	int         bbox_chars_num;
+
+	/* Id of the line that extract_add_char() found this span to be part of,
+	shared with earlier spans that it continues, or 0 if not known. Used by
+	make_lines() as a hint; the spans may since have been split or moved. */
+	int         line_id;
 };
 
 void extract_span_init(span_t *span, structure_t *structure);
 
+/* Number of distinct values of span_t::rotation_class; must be a power of
+two. */
+#define extract_span_ROTATION_CLASSES 64
+
+/* Sets span->dir, span->scale_squared and span->rotation_class from
+span->ctm and span->flags.wmode. */
+void extract_span_geometry_init(span_t *span);
+
+/* Returns union of the bboxes of the chars in <span>. */
+rect_t extract_span_bbox(span_t *span);
+
 /* Frees a span_t, returning with *pspan set to NULL. */
 void extract_span_free(extract_alloc_t *alloc, span_t **pspan);
 
@@ -524,6 +604,11 @@ struct image_t
 
 	extract_image_data_free *data_free;
 	void                    *data_free_handle;
+
+	/* If non-zero, this image has the same type and data as an earlier
+	image, and shares its id and name; its own data has already been
+	released, and it is not written to the output archive. */
+	int                      duplicate;
 };
 
 void extract_image_init(image_t *image);
@@ -643,12 +728,56 @@ typedef struct
 } extract_page_t;
 
 
+/* A font as used by spans: name plus the flags that affect how text is
+written. */
+typedef struct
+{
+	char *name;
+	int   bold;
+	int   italic;
+} font_entry_t;
+
+/* Per-document table of interned fonts, so that spans can refer to fonts
+by index and writers can detect font changes with integer comparisons. */
+typedef struct
+{
+	font_entry_t *fonts;
+	int           fonts_num;
+	int           fonts_max;
+
+	/* Open-addressed hash of indices into fonts[], -1 for empty slots;
+	hash_num is zero or a power of two. */
+	int          *hash;
+	int           hash_num;
+} fonts_t;
+
+void extract_fonts_init(fonts_t *fonts);
+
+void extract_fonts_free(extract_alloc_t *alloc, fonts_t *fonts);
+
+/* Removes all fonts, keeping the allocated arrays. */
+void extract_fonts_clear(extract_alloc_t *alloc, fonts_t *fonts);
+
+/* Sets *o_id to the index in fonts->fonts[] of the font with the given name
+and flags, adding a new entry if it is not already present. */
+int extract_fonts_intern(
+		extract_alloc_t *alloc,
+		fonts_t         *fonts,
+		const char      *name,
+		int              bold,
+		int              italic,
+		int             *o_id);
+
+
 /* A list of pages. */
 typedef struct
 {
 	extract_page_t **pages;
 	int              pages_num;
 
+	/* Fonts used by spans in all pages. */
+	fonts_t          fonts;
+
 	/* All the structure for the document. */
 	structure_t    *structure;
 
@@ -660,15 +789,82 @@ typedef struct
 
 typedef struct
 {
+	/* All images that are to be written to the output archive, accumulated
+	across calls to extract_process(). */
 	image_t **images;
 	int       images_num;
+	int       images_max;
+
+	/* Distinct image types, in the order in which they were first seen;
+	these point to the type strings of images in images[]. */
 	char    **imagetypes;
 	int       imagetypes_num;
+	int       imagetypes_max;
+
+	/* Open-addressed hash of indices into imagetypes[], -1 for empty
+	slots; imagetypes_hash_num is zero or a power of two. */
+	int      *imagetypes_hash;
+	int       imagetypes_hash_num;
 } images_t;
 
 
-/* This does all the work of finding paragraphs and tables. */
-int extract_document_join(extract_alloc_t *alloc, document_t *document, int layout_analysis, double master_space_guess);
+/* Per-page limits for extract_document_join(); zero means no limit. */
+typedef struct
+{
+	int     max_spans;
+	int     max_tablelines;
+	double  max_seconds;
+} join_limits_t;
+
+/* Time limit for processing a page. */
+typedef struct
+{
+	/* From extract_clock(); zero means no limit. */
+	double  end;
+
+	/* Set by extract_deadline_passed() when it returns non-zero. */
+	int     expired;
+} deadline_t;
+
+/* Returns non-zero if <deadline> has a limit and extract_clock() has reached
+it. Callers only ask when they would skip or shorten some work as a result, so
+deadline->expired records whether the limit made any difference. */
+static inline int extract_deadline_passed(deadline_t *deadline)
+{
+	double now;
+
+	if (deadline->end == 0) return 0;
+	now = extract_clock();
+	if (now < 0 || now < deadline->end) return 0;
+	deadline->expired = 1;
+	return 1;
+}
+
+/* Progress callback set by extract_set_progress_fn(). */
+typedef struct
+{
+	extract_progress_fn  *fn;
+	void                 *handle;
+} progress_t;
+
+/* Calls progress->fn if it is set. Returns -1 with errno=ECANCELED if it
+asks us to stop, otherwise 0. */
+int extract_progress(const progress_t *progress, extract_progress_stage_t stage, int n, int n_max);
+
+/* This does all the work of finding paragraphs and tables. <profile> selects
+which stages are run, as described for extract_set_profile(). Pages that
+exceed <limits> are processed with extract_profile_FAST, and counted in
+<stats>, as are pages where max_seconds caused any work to be skipped.
+<progress> is told about each stage of each page. */
+int extract_document_join(
+		extract_alloc_t      *alloc,
+		document_t           *document,
+		int                   layout_analysis,
+		double                master_space_guess,
+		extract_profile_t     profile,
+		const join_limits_t  *limits,
+		extract_page_stats_t *stats,
+		const progress_t     *progress);
 
 double extract_font_size(matrix4_t *ctm);
 
@@ -689,11 +885,15 @@ span. */
 typedef struct
 {
 	font_t     font;
+	/* font_id of span that font was set from; only meaningful if font.name
+	is not NULL. */
+	int        font_id;
 	matrix4_t *ctm_prev;
 } content_state_t;
 
-/* Analyse page content for layouts. */
-int extract_page_analyse(extract_alloc_t *alloc, extract_page_t *page);
+/* Analyse page content for layouts. Stops subdividing once <deadline> has
+passed. */
+int extract_page_analyse(extract_alloc_t *alloc, extract_page_t *page, deadline_t *deadline);
 
 /* subpage_t constructor. */
 int extract_subpage_alloc(extract_alloc_t *extract, rect_t mediabox, extract_page_t *page, subpage_t **psubpage);
@@ -15,6 +15,7 @@ docx_paragraph_finish(). */
 #include "mem.h"
 #include "memento.h"
 #include "outf.h"
+#include "styles.h"
 #include "sys.h"
 #include "text.h"
 #include "zip.h"
@@ -42,38 +43,56 @@ docx_paragraph_finish(extract_alloc_t *alloc, extract_astring_t *output)
 	return extract_astring_cat(alloc, output, "\n</w:p>");
 }
 
+/* Sets style->run_start to the markup that starts a run in <style>. */
+static int
+docx_style_run_start(
+		extract_alloc_t   *alloc,
+		extract_style_t   *style)
+{
+	int               e = 0;
+	extract_astring_t text;
+
+	extract_astring_init(&text);
+	if (!e) e = extract_astring_cat(alloc, &text, "\n<w:r><w:rPr><w:rFonts w:ascii=\"");
+	if (!e) e = extract_astring_cat(alloc, &text, style->font.name);
+	if (!e) e = extract_astring_cat(alloc, &text, "\" w:hAnsi=\"");
+	if (!e) e = extract_astring_cat(alloc, &text, style->font.name);
+	if (!e) e = extract_astring_cat(alloc, &text, "\"/>");
+	if (!e && style->font.bold) e = extract_astring_cat(alloc, &text, "<w:b/>");
+	if (!e && style->font.italic) e = extract_astring_cat(alloc, &text, "<w:i/>");
+	if (!e) e = extract_astring_cat(alloc, &text, "<w:sz w:val=\"");
+	if (!e) e = extract_astring_catd(alloc, &text, style->font.size * 2, 6);
+	if (!e) e = extract_astring_cat(alloc, &text, "\"/>");
+	if (!e) e = extract_astring_cat(alloc, &text, "<w:szCs w:val=\"");
+	if (!e) e = extract_astring_catd(alloc, &text, style->font.size * 2, 6);
+	if (!e) e = extract_astring_cat(alloc, &text, "\"/>");
+	if (!e) e = extract_astring_cat(alloc, &text, "</w:rPr><w:t xml:space=\"preserve\">");
+
+	if (e)
+		extract_astring_free(alloc, &text);
+	else
+		style->run_start = text.chars;
+
+	return e;
+}
+
 /* Starts a new run. Caller must ensure that docx_run_finish() was
-called to terminate any previous run. */
+called to terminate any previous run.
+
+The run properties for each distinct font/size/bold/italic combination are
+formatted once and kept in <styles>. */
 static int
 docx_run_start(	extract_alloc_t   *alloc,
 		extract_astring_t *output,
+		extract_styles_t  *styles,
 		content_state_t   *content_state)
 {
-	int e = 0;
-
-	if (!e) e = extract_astring_cat(alloc, output, "\n<w:r><w:rPr><w:rFonts w:ascii=\"");
-	if (!e) e = extract_astring_cat(alloc, output, content_state->font.name);
-	if (!e) e = extract_astring_cat(alloc, output, "\" w:hAnsi=\"");
-	if (!e) e = extract_astring_cat(alloc, output, content_state->font.name);
-	if (!e) e = extract_astring_cat(alloc, output, "\"/>");
-	if (!e && content_state->font.bold) e = extract_astring_cat(alloc, output, "<w:b/>");
-	if (!e && content_state->font.italic) e = extract_astring_cat(alloc, output, "<w:i/>");
-	{
-		char font_size_text[32];
+	extract_style_t *style;
 
-		if (!e) e = extract_astring_cat(alloc, output, "<w:sz w:val=\"");
-		snprintf(font_size_text, sizeof(font_size_text), "%f", content_state->font.size * 2);
-		extract_astring_cat(alloc, output, font_size_text);
-		extract_astring_cat(alloc, output, "\"/>");
+	if (extract_styles_add(alloc, styles, &content_state->font, &style)) return -1;
+	if (!style->run_start && docx_style_run_start(alloc, style)) return -1;
 
-		if (!e) e = extract_astring_cat(alloc, output, "<w:szCs w:val=\"");
-		snprintf(font_size_text, sizeof(font_size_text), "%f", content_state->font.size * 2);
-		extract_astring_cat(alloc, output, font_size_text);
-		extract_astring_cat(alloc, output, "\"/>");
-	}
-	if (!e) e = extract_astring_cat(alloc, output, "</w:rPr><w:t xml:space=\"preserve\">");
-
-	return e;
+	return extract_astring_cat(alloc, output, style->run_start);
 }
 
 static int
@@ -90,7 +109,8 @@ docx_run_finish(extract_alloc_t   *alloc,
 static int
 docx_paragraph_empty(
 		extract_alloc_t   *alloc,
-		extract_astring_t *output)
+		extract_astring_t *output,
+		extract_styles_t  *styles)
 {
 	int e = -1;
 	static char fontname[] = "OpenSans";
@@ -106,7 +126,7 @@ docx_paragraph_empty(
 	content_state.font.bold = 0;
 	content_state.font.italic = 0;
 
-	if (docx_run_start(alloc, output, &content_state)) goto end;
+	if (docx_run_start(alloc, output, styles, &content_state)) goto end;
 	//docx_char_append_string(output, "&#160;");   /* &#160; is non-break space. */
 	if (docx_run_finish(alloc, NULL /*state*/, output)) goto end;
 	if (docx_paragraph_finish(alloc, output)) goto end;
@@ -136,7 +156,8 @@ document_to_docx_content_paragraph(
 		extract_alloc_t   *alloc,
 		content_state_t   *content_state,
 		paragraph_t       *paragraph,
-		extract_astring_t *content)
+		extract_astring_t *content,
+		extract_styles_t  *styles)
 {
 	int                    e = -1;
 	content_line_iterator  lit;
@@ -172,15 +193,13 @@ document_to_docx_content_paragraph(
 
 		for (span = content_span_iterator_init(&sit, &line->content); span != NULL; span = content_span_iterator_next(&sit))
 		{
-			int si;
 			double font_size_new;
 
 			content_state->ctm_prev = &span->ctm;
 			font_size_new = extract_font_size(&span->ctm);
+			/* font_id covers font name, bold and italic. */
 			if (!content_state->font.name
-				|| strcmp(span->font_name, content_state->font.name)
-				|| span->flags.font_bold != content_state->font.bold
-				|| span->flags.font_italic != content_state->font.italic
+				|| span->font_id != content_state->font_id
 				|| font_size_new != content_state->font.size)
 			{
 				if (content_state->font.name)
@@ -188,20 +207,21 @@ document_to_docx_content_paragraph(
 						goto end;
 
 				content_state->font.name = span->font_name;
+				content_state->font_id = span->font_id;
 				content_state->font.bold = span->flags.font_bold;
 				content_state->font.italic = span->flags.font_italic;
 				content_state->font.size = font_size_new;
-				if (docx_run_start(alloc, content, content_state))
+				if (docx_run_start(alloc, content, styles, content_state))
 					goto end;
 			}
 
-			for (si=0; si<span->chars_num; ++si)
-			{
-				char_t* char_ = &span->chars[si];
-				int c = char_->ucs;
-				if (extract_astring_catc_unicode_xml(alloc, content, c))
-					goto end;
-			}
+			if (span->chars_num && extract_astring_catl_unicode_xml(
+					alloc,
+					content,
+					&span->chars[0].ucs,
+					sizeof(char_t),
+					span->chars_num))
+				goto end;
 			/* Remove any trailing '-' at end of line. */
 			if (docx_char_truncate_if(content, '-'))
 				goto end;
@@ -307,6 +327,7 @@ docx_output_rotated_paragraphs(
 		int                h,
 		int                text_box_id,
 		extract_astring_t *output,
+		extract_styles_t  *styles,
 		content_state_t   *state)
 {
 	int                         e = -1;
@@ -382,7 +403,7 @@ docx_output_rotated_paragraphs(
 
 	/* Output paragraphs p0..p2-1. */
 	for (paragraph = content_paragraph_iterator_init(&pit, &block->content); paragraph != NULL; paragraph = content_paragraph_iterator_next(&pit))
-		if (document_to_docx_content_paragraph(alloc, state, paragraph, output)) goto end;
+		if (document_to_docx_content_paragraph(alloc, state, paragraph, output, styles)) goto end;
 
 	extract_astring_cat(alloc, output, "\n");
 	extract_astring_cat(alloc, output, "                    </w:txbxContent>\n");
@@ -415,7 +436,7 @@ docx_output_rotated_paragraphs(
 	extract_astring_cat(alloc, output, "              <w:txbxContent>");
 
 	for (paragraph = content_paragraph_iterator_init(&pit, &block->content); paragraph != NULL; paragraph = content_paragraph_iterator_next(&pit))
-		if (document_to_docx_content_paragraph(alloc, state, paragraph, output)) goto end;
+		if (document_to_docx_content_paragraph(alloc, state, paragraph, output, styles)) goto end;
 
 	extract_astring_cat(alloc, output, "\n");
 	extract_astring_cat(alloc, output, "\n");
@@ -444,7 +465,8 @@ static int
 docx_append_table(
 		extract_alloc_t   *alloc,
 		table_t           *table,
-		extract_astring_t *output)
+		extract_astring_t *output,
+		extract_styles_t  *styles)
 {
 	int e = -1;
 	int y;
@@ -513,7 +535,7 @@ docx_append_table(
 				content_state.font.name = NULL;
 				content_state.ctm_prev = NULL;
 				for (paragraph = content_paragraph_iterator_init(&pit, &cell->content); paragraph != NULL; paragraph = content_paragraph_iterator_next(&pit))
-					if (document_to_docx_content_paragraph(alloc, &content_state, paragraph, output))
+					if (document_to_docx_content_paragraph(alloc, &content_state, paragraph, output, styles))
 						goto end;
 
 				if (content_state.font.name)
@@ -551,7 +573,8 @@ docx_append_rotated_paragraphs(
 		block_t            *block,
 		int                *text_box_id,
 		double              angle,
-		extract_astring_t  *output)
+		extract_astring_t  *output,
+		extract_styles_t   *styles)
 {
 	/* Find extent of paragraphs with this same rotation. extent
 	will contain max width and max height of paragraphs, in units
@@ -586,7 +609,7 @@ docx_append_rotated_paragraphs(
 
 		if (0) outf("rotate: %f rad, %f deg. rot=%i", angle, angle*180/pi, rot);
 
-		if (docx_output_rotated_paragraphs(alloc, block, rot, x, y, w, h, *text_box_id, output, state))
+		if (docx_output_rotated_paragraphs(alloc, block, rot, x, y, w, h, *text_box_id, output, styles, state))
 			goto end;
 	}
 
@@ -603,7 +626,8 @@ extract_document_to_docx_content(
 		int                spacing,
 		int                rotation,
 		int                images,
-		extract_astring_t *output)
+		extract_astring_t *output,
+		extract_styles_t  *styles)
 {
 	int e = -1;
 	int text_box_id = 0;
@@ -664,19 +688,19 @@ extract_document_to_docx_content(
 						/* Extra vertical space between paragraphs that
 						 * were at different angles in the original
 						 * document. */
-						if (docx_paragraph_empty(alloc, output))
+						if (docx_paragraph_empty(alloc, output, styles))
 							goto end;
 					}
 
 					/* Extra vertical space between paragraphs. */
 					if (spacing)
-						if (docx_paragraph_empty(alloc, output))
+						if (docx_paragraph_empty(alloc, output, styles))
 							goto end;
 
 					if (rotation && angle != 0)
 					{
 						assert(block);
-						if (docx_append_rotated_paragraphs(alloc, &content_state, block, &text_box_id, angle, output))
+						if (docx_append_rotated_paragraphs(alloc, &content_state, block, &text_box_id, angle, output, styles))
 							goto end;
 					}
 					else if (block)
@@ -689,24 +713,24 @@ extract_document_to_docx_content(
 							if (spacing && !first)
 							{
 								/* Extra vertical space between paragraphs. */
-								if (docx_paragraph_empty(alloc, output))
+								if (docx_paragraph_empty(alloc, output, styles))
 									goto end;
 							}
 							first = 0;
 
-							if (document_to_docx_content_paragraph(alloc, &content_state, paragraph, output)) goto end;
+							if (document_to_docx_content_paragraph(alloc, &content_state, paragraph, output, styles)) goto end;
 						}
 					}
 					else
 					{
-						if (document_to_docx_content_paragraph(alloc, &content_state, paragraph, output))
+						if (document_to_docx_content_paragraph(alloc, &content_state, paragraph, output, styles))
 							goto end;
 					}
 					content = content_iterator_next(&cit);
 				}
 				else if (table)
 				{
-					if (docx_append_table(alloc, table, output))
+					if (docx_append_table(alloc, table, output, styles))
 						goto end;
 					table = content_table_iterator_next(&tit);
 				}
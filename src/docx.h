@@ -5,10 +5,15 @@
 
 /* Things for creating docx files. */
 
+#include "styles.h"
+
 /*
 	Make *o_content point to a string containing all paragraphs, images and
 	tables (tables as of 2021-07-22) in *document in docx XML format.
 
+	Run properties are cached in <styles>, which can be shared between
+	calls.
+
 	This string can be passed to extract_docx_content_item() or
 	extract_docx_write_template() to be inserted into a docx archive's
 	word/document.xml.
@@ -19,7 +24,8 @@ int extract_document_to_docx_content(
 		int                spacing,
 		int                rotation,
 		int                images,
-		extract_astring_t *content);
+		extract_astring_t *content,
+		extract_styles_t  *styles);
 
 
 /*
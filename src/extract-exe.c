@@ -70,6 +70,8 @@ int main(int argc, const char** argv)
     int         autosplit           = 0;
     int         images              = 1;
     int         alloc_stats         = 0;
+    int         pool                = 0;
+    int         profile             = extract_profile_FULL;
     int         format              = -1;
     int         i;
 
@@ -115,6 +117,12 @@ int main(int argc, const char** argv)
                     "    -p 0|1\n"
                     "        If 1 and -t <docx-template> is specified, we preserve the\n"
                     "        uncompressed <docx-path>.lib/ directory.\n"
+                    "    --profile full | balanced | fast\n"
+                    "        Sets processing profile; see extract_set_profile(). Default is\n"
+                    "        full.\n"
+                    "    --pool 0|1\n"
+                    "        If 1, we allocate content tree nodes from pools of same-sized\n"
+                    "        blocks; see extract_alloc_pool().\n"
                     "    -r 0|1\n"
                     "       If 1, we we output rotated text inside a rotated drawing. Otherwise\n"
                     "       output text is always horizontal.\n"
@@ -169,6 +177,22 @@ int main(int argc, const char** argv)
         else if (!strcmp(arg, "-p")) {
             if (arg_next_int(argv, argc, &i, &preserve_dir)) goto end;
         }
+        else if (!strcmp(arg, "--profile")) {
+            const char* profile_name;
+            if (arg_next_string(argv, argc, &i, &profile_name)) goto end;
+            if (!strcmp(profile_name, "full")) profile = extract_profile_FULL;
+            else if (!strcmp(profile_name, "balanced")) profile = extract_profile_BALANCED;
+            else if (!strcmp(profile_name, "fast")) profile = extract_profile_FAST;
+            else
+            {
+                printf("--profile value should be 'full', 'balanced' or 'fast', not '%s'.\n", profile_name);
+                errno = EINVAL;
+                goto end;
+            }
+        }
+        else if (!strcmp(arg, "--pool")) {
+            if (arg_next_int(argv, argc, &i, &pool)) goto end;
+        }
         else if (!strcmp(arg, "-r")) {
             if (arg_next_int(argv, argc, &i, &rotation)) goto end;
         }
@@ -214,7 +238,9 @@ int main(int argc, const char** argv)
         goto end;
     }
 
+    if (extract_alloc_pool(alloc, pool)) goto end;
     if (extract_begin(alloc, format, &extract)) goto end;
+    if (extract_set_profile(extract, profile)) goto end;
     if (extract_read_intermediate(extract, intermediate)) goto end;
 
     if (extract_process(extract, spacing, rotation, images)) goto end;
@@ -0,0 +1,834 @@
+/* Unit tests for the extract_t API, driven with small made-up pages. */
+
+#include "extract/extract.h"
+#include "extract/alloc.h"
+#include "extract/buffer.h"
+
+#include "astring.h"
+#include "memento.h"
+#include "sys.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static int s_num_fails = 0;
+
+static void s_check_e(int e, const char *text)
+{
+	if (e)
+	{
+		s_num_fails += 1;
+		printf("Error: e=%i: %s\n", e, text);
+	}
+}
+
+static void s_check_text(const char *actual, const char *expected, const char *text)
+{
+	if (!actual) actual = "";
+	if (strcmp(actual, expected))
+	{
+		s_num_fails += 1;
+		printf("Error: %s:\n    expected: %s\n    actual:   %s\n", text, expected, actual);
+	}
+}
+
+static int s_write_astring(void *handle, const void *source, size_t numbytes, size_t *o_actual)
+{
+	extract_astring_t *string = handle;
+	if (extract_astring_catl(NULL, string, source, numbytes)) return -1;
+	*o_actual = numbytes;
+	return 0;
+}
+
+/* Calls extract_process() and then writes content into <content>, which is
+emptied first. */
+static int s_process(extract_t *extract, extract_astring_t *content)
+{
+	extract_buffer_t *buffer;
+	int               e;
+
+	extract_astring_clear(content);
+	if (extract_process(extract, 0 /*spacing*/, 0 /*rotation*/, 1 /*images*/)) return -1;
+	if (extract_buffer_open(NULL, content, NULL /*fn_read*/, s_write_astring, NULL /*fn_cache*/, NULL /*fn_close*/, &buffer)) return -1;
+	e = extract_write_content(extract, buffer);
+	if (extract_buffer_close(&buffer)) e = -1;
+	return e;
+}
+
+/* Reads intermediate-format <xml> into <extract>. */
+static int s_read_intermediate(extract_t *extract, const char *xml)
+{
+	extract_buffer_t *buffer;
+	int               e;
+
+	if (extract_buffer_open_simple(NULL, xml, strlen(xml), NULL, NULL, &buffer)) return -1;
+	e = extract_read_intermediate(extract, buffer);
+	if (extract_buffer_close(&buffer)) e = -1;
+	return e;
+}
+
+/* Fake bold: the second span redraws "Hi" 0.3pt to the right, in a different
+font so that it is not continued from the first span. With overprint dedup that
+leaves the second span empty. */
+static const char s_overprint_xml[] =
+	"<page>\n"
+	"<span ctm=\"1 0 0 1 0 0\" trm=\"10 0 0 10 0 0\" font_name=\"Helvetica\" wmode=\"0\">\n"
+	"<char x=\"100\" y=\"100\" adv=\"7.2\" ucs=\"72\"/>\n"
+	"<char x=\"107.2\" y=\"100\" adv=\"2.2\" ucs=\"105\"/>\n"
+	"</span>\n"
+	"<span ctm=\"1 0 0 1 0 0\" trm=\"10 0 0 10 0 0\" font_name=\"Helvetica-Bold\" wmode=\"0\">\n"
+	"<char x=\"100.3\" y=\"100\" adv=\"7.2\" ucs=\"72\"/>\n"
+	"<char x=\"107.5\" y=\"100\" adv=\"2.2\" ucs=\"105\"/>\n"
+	"</span>\n"
+	"<span ctm=\"1 0 0 1 0 0\" trm=\"10 0 0 10 0 0\" font_name=\"Helvetica\" wmode=\"0\">\n"
+	"<char x=\"109.4\" y=\"100\" adv=\"2.8\" ucs=\"32\"/>\n"
+	"<char x=\"112.2\" y=\"100\" adv=\"2.8\" ucs=\"116\"/>\n"
+	"<char x=\"115\" y=\"100\" adv=\"5.6\" ucs=\"104\"/>\n"
+	"<char x=\"120.6\" y=\"100\" adv=\"5.6\" ucs=\"101\"/>\n"
+	"<char x=\"126.2\" y=\"100\" adv=\"3.3\" ucs=\"114\"/>\n"
+	"<char x=\"129.5\" y=\"100\" adv=\"5.6\" ucs=\"101\"/>\n"
+	"</span>\n"
+	"</page>\n";
+
+static void s_check_overprint_intermediate(void)
+{
+	extract_t         *extract;
+	extract_astring_t  content;
+	int                dedup;
+
+	printf("testing overprint dedup with extract_read_intermediate():\n");
+	extract_astring_init(&content);
+	for (dedup = 0; dedup < 2; ++dedup)
+	{
+		s_check_e(extract_begin(NULL, extract_format_TEXT, &extract), "extract_begin()");
+		s_check_e(extract_set_overprint_dedup(extract, dedup), "extract_set_overprint_dedup()");
+		s_check_e(s_read_intermediate(extract, s_overprint_xml), "extract_read_intermediate()");
+		s_check_e(s_process(extract, &content), "extract_process()");
+		s_check_text(content.chars, dedup ? "Hi there\n" : "HiHi there\n", "overprinted span");
+		extract_end(&extract);
+	}
+	extract_astring_free(NULL, &content);
+}
+/* Adds a span containing the single char <ucs> at (x, y), with a 6x10 bbox. */
+static int s_add_char_span(extract_t *extract, double x, double y, unsigned ucs)
+{
+	if (extract_span_begin(extract, "Helvetica", 0, 0, 0 /*wmode*/, 10, 0, 0, 10, 0, 0, 0.6, 1)) return -1;
+	if (extract_add_char(extract, x, y, ucs, 0.6, x, y, x + 6, y + 10)) return -1;
+	return extract_span_end(extract);
+}
+
+/* Adds a span containing <text> starting at (x, y), with a baseline rotated
+by <degrees> and chars 6 units apart. */
+static int s_add_text_rotated(extract_t *extract, double x, double y, double degrees, const char *text)
+{
+	double c = cos(degrees * 3.14159265358979323846 / 180);
+	double s = sin(degrees * 3.14159265358979323846 / 180);
+
+	if (extract_span_begin(extract, "Helvetica", 0, 0, 0 /*wmode*/, 10 * c, 10 * s, -10 * s, 10 * c, 0, 0, 0.6, 1)) return -1;
+	for (; *text; ++text, x += 6 * c, y += 6 * s)
+	{
+		if (extract_add_char(extract, x, y, (unsigned char) *text, 0.6, x, y - 10, x + 6, y)) return -1;
+	}
+	return extract_span_end(extract);
+}
+
+/* Adds a span containing <text> starting at (x, y), 6 units apart. */
+static int s_add_text(extract_t *extract, double x, double y, const char *text)
+{
+	return s_add_text_rotated(extract, x, y, 0, text);
+}
+
+/* How s_add_table_page_ruled() draws the table's rules. */
+typedef enum
+{
+	s_rules_LINES,
+	s_rules_FILL,
+	s_rules_STROKE,
+	s_rules_NONE
+} s_rules_t;
+
+/* Draws the rules of a 2x2 table as one compound fill path of thin
+rectangles, with subpaths that are closed or unclosed in each of the ways
+that extract_fill_begin() accepts, mixed with subpaths that are not
+rectangles. */
+static int s_fill_rules(extract_t *extract)
+{
+	int i;
+
+	if (extract_fill_begin(extract, 1, 0, 0, 1, 0, 0, 0 /*color*/)) return -1;
+
+	/* Top rule, closed with closepath. */
+	if (extract_moveto(extract, 100, 99.5)) return -1;
+	if (extract_lineto(extract, 300, 99.5)) return -1;
+	if (extract_lineto(extract, 300, 100.5)) return -1;
+	if (extract_lineto(extract, 100, 100.5)) return -1;
+	if (extract_closepath(extract)) return -1;
+
+	/* Left rule, with no moveto so it starts at the first point of the
+	previous subpath. */
+	if (extract_lineto(extract, 101, 99.5)) return -1;
+	if (extract_lineto(extract, 101, 160.5)) return -1;
+	if (extract_lineto(extract, 100, 160.5)) return -1;
+	if (extract_closepath(extract)) return -1;
+
+	/* Middle rule, not closed, ended by the next moveto. */
+	if (extract_moveto(extract, 100, 129.5)) return -1;
+	if (extract_lineto(extract, 300, 129.5)) return -1;
+	if (extract_lineto(extract, 300, 130.5)) return -1;
+	if (extract_lineto(extract, 100, 130.5)) return -1;
+
+	/* A triangle, which is ignored. */
+	if (extract_moveto(extract, 400, 400)) return -1;
+	if (extract_lineto(extract, 450, 400)) return -1;
+	if (extract_lineto(extract, 420, 450)) return -1;
+	if (extract_closepath(extract)) return -1;
+
+	/* Bottom rule, closed with an explicit return to its first point. */
+	if (extract_moveto(extract, 100, 159.5)) return -1;
+	if (extract_lineto(extract, 300, 159.5)) return -1;
+	if (extract_lineto(extract, 300, 160.5)) return -1;
+	if (extract_lineto(extract, 100, 160.5)) return -1;
+	if (extract_lineto(extract, 100, 159.5)) return -1;
+
+	/* A flattened curve, which has too many points and is ignored. */
+	if (extract_moveto(extract, 400, 500)) return -1;
+	for (i = 1; i <= 8; ++i)
+	{
+		if (extract_lineto(extract, 400 + 10*i, 500 + i*i)) return -1;
+	}
+
+	/* Middle vertical rule, with a zero-length segment. */
+	if (extract_moveto(extract, 199.5, 100)) return -1;
+	if (extract_lineto(extract, 200.5, 100)) return -1;
+	if (extract_lineto(extract, 200.5, 100)) return -1;
+	if (extract_lineto(extract, 200.5, 160)) return -1;
+	if (extract_lineto(extract, 199.5, 160)) return -1;
+	if (extract_closepath(extract)) return -1;
+
+	/* Right rule, not closed, ended by extract_fill_end(). */
+	if (extract_moveto(extract, 299.5, 100)) return -1;
+	if (extract_lineto(extract, 300.5, 100)) return -1;
+	if (extract_lineto(extract, 300.5, 160)) return -1;
+	if (extract_lineto(extract, 299.5, 160)) return -1;
+
+	return extract_fill_end(extract);
+}
+
+/* Draws the rules of a 2x2 table as one stroked path: a closed border, where
+extract_closepath() adds the left rule, and two open subpaths. */
+static int s_stroke_rules(extract_t *extract)
+{
+	if (extract_stroke_begin(extract, 1, 0, 0, 1, 0, 0, 1 /*width*/, 0 /*color*/)) return -1;
+	if (extract_moveto(extract, 100, 100)) return -1;
+	if (extract_lineto(extract, 300, 100)) return -1;
+	if (extract_lineto(extract, 300, 160)) return -1;
+	if (extract_lineto(extract, 100, 160)) return -1;
+	if (extract_closepath(extract)) return -1;
+	if (extract_moveto(extract, 100, 130)) return -1;
+	if (extract_lineto(extract, 300, 130)) return -1;
+	if (extract_moveto(extract, 200, 100)) return -1;
+	if (extract_lineto(extract, 200, 160)) return -1;
+	return extract_stroke_end(extract);
+}
+
+/* Adds a page with a 2x2 table with rules drawn as specified by <rules>,
+followed by a centred two-line paragraph. */
+static int s_add_table_page_ruled(extract_t *extract, s_rules_t rules)
+{
+	int i;
+
+	if (extract_page_begin(extract, 0, 0, 600, 800)) return -1;
+	if (rules == s_rules_LINES)
+	{
+		for (i = 0; i < 3; ++i)
+		{
+			if (extract_add_line(extract, 1, 0, 0, 1, 0, 0, 1 /*width*/, 100 + 100*i, 100, 100 + 100*i, 160, 0)) return -1;
+			if (extract_add_line(extract, 1, 0, 0, 1, 0, 0, 1 /*width*/, 100, 100 + 30*i, 300, 100 + 30*i, 0)) return -1;
+		}
+	}
+	else if (rules == s_rules_FILL)
+	{
+		if (s_fill_rules(extract)) return -1;
+	}
+	else if (rules == s_rules_STROKE)
+	{
+		if (s_stroke_rules(extract)) return -1;
+	}
+	if (s_add_text(extract, 110, 120, "a")) return -1;
+	if (s_add_text(extract, 210, 120, "b")) return -1;
+	if (s_add_text(extract, 110, 150, "c")) return -1;
+	if (s_add_text(extract, 210, 150, "d")) return -1;
+	if (s_add_text(extract, 100, 300, "Hello")) return -1;
+	if (s_add_text(extract, 109, 312, "Hi")) return -1;
+	return extract_page_end(extract);
+}
+
+/* Adds a page with a 2x2 table ruled with stroked lines, followed by a
+centred two-line paragraph. */
+static int s_add_table_page(extract_t *extract)
+{
+	return s_add_table_page_ruled(extract, s_rules_LINES);
+}
+
+static void s_check_rotation_classes(void)
+{
+	/* Both baselines are within a degree of each other, but on either side
+	of the boundary between the rotation classes centred on 0 and 5.625
+	degrees. */
+	static const double  angles[][2] = { { 2.7, 2.9 }, { 2.9, 2.7 }, { -2.7, -2.9 }, { 0, 2.7 } };
+	extract_t           *extract;
+	extract_astring_t    content;
+	int                  i;
+
+	printf("testing joining of spans near a rotation class boundary:\n");
+	extract_astring_init(&content);
+	for (i = 0; i < (int) (sizeof(angles) / sizeof(angles[0])); ++i)
+	{
+		/* "world" starts one space after the end of "Hello", along the
+		baseline of "Hello". */
+		double c = cos(angles[i][0] * 3.14159265358979323846 / 180);
+		double s = sin(angles[i][0] * 3.14159265358979323846 / 180);
+
+		s_check_e(extract_begin(NULL, extract_format_TEXT, &extract), "extract_begin()");
+		s_check_e(extract_page_begin(extract, 0, 0, 600, 800), "extract_page_begin()");
+		s_check_e(s_add_text_rotated(extract, 100, 100, angles[i][0], "Hello"), "adding Hello");
+		s_check_e(s_add_text_rotated(extract, 100 + 33 * c, 100 + 33 * s, angles[i][1], "world"), "adding world");
+		s_check_e(extract_page_end(extract), "extract_page_end()");
+		s_check_e(s_process(extract, &content), "extract_process()");
+		s_check_text(content.chars, "Hello world\n", "spans in neighbouring rotation classes");
+		extract_end(&extract);
+	}
+	extract_astring_free(NULL, &content);
+}
+
+/* Writes a summary of docx <content> into <summary>: "table{...}" for each
+table, and "<alignment>:<text>;" for each paragraph. */
+static int s_docx_summary(const char *content, extract_astring_t *summary)
+{
+	static const char jc[] = "<w:jc w:val=\"";
+	static const char text[] = "xml:space=\"preserve\">";
+	const char       *p;
+
+	extract_astring_clear(summary);
+	for (p = content; *p; ++p)
+	{
+		if (!strncmp(p, "<w:tbl>", 7))
+		{
+			if (extract_astring_cat(NULL, summary, "table{")) return -1;
+		}
+		else if (!strncmp(p, "</w:tbl>", 8))
+		{
+			if (extract_astring_cat(NULL, summary, "}")) return -1;
+		}
+		else if (!strncmp(p, jc, sizeof(jc) - 1))
+		{
+			p += sizeof(jc) - 1;
+			if (extract_astring_catl(NULL, summary, p, strcspn(p, "\""))) return -1;
+			if (extract_astring_cat(NULL, summary, ":")) return -1;
+		}
+		else if (!strncmp(p, text, sizeof(text) - 1))
+		{
+			p += sizeof(text) - 1;
+			if (extract_astring_catl(NULL, summary, p, strcspn(p, "<"))) return -1;
+			if (extract_astring_cat(NULL, summary, ";")) return -1;
+		}
+	}
+	return 0;
+}
+
+static void s_check_profiles(void)
+{
+	/* FULL finds the table and the centred paragraph, BALANCED finds the
+	table but outputs all paragraphs as left-aligned, and FAST does not look
+	for tables. */
+	static const char *expected[] =
+	{
+		"table{both:a;both:b;both:c;both:d;}center:Hello Hi;",
+		"table{left:a;left:b;left:c;left:d;}left:Hello Hi;",
+		"left:a;left:b;left:c;left:d;left:Hello Hi;"
+	};
+	extract_t         *extract;
+	extract_astring_t  content;
+	extract_astring_t  summary;
+	extract_profile_t  profile;
+
+	printf("testing extract_set_profile():\n");
+	extract_astring_init(&content);
+	extract_astring_init(&summary);
+	for (profile = extract_profile_FULL; profile <= extract_profile_FAST; profile += 1)
+	{
+		s_check_e(extract_begin(NULL, extract_format_DOCX, &extract), "extract_begin()");
+		s_check_e(extract_set_profile(extract, profile), "extract_set_profile()");
+		s_check_e(s_add_table_page(extract), "s_add_table_page()");
+		s_check_e(s_process(extract, &content), "extract_process()");
+		s_check_e(s_docx_summary(content.chars, &summary), "s_docx_summary()");
+		s_check_text(summary.chars, expected[profile], "profile output");
+		extract_end(&extract);
+	}
+	extract_astring_free(NULL, &summary);
+	extract_astring_free(NULL, &content);
+}
+
+static void s_check_paths(void)
+{
+	static const char full[] = "table{both:a;both:b;both:c;both:d;}center:Hello Hi;";
+	static const struct
+	{
+		s_rules_t   rules;
+		const char *expected;
+	} tests[] =
+	{
+		{ s_rules_LINES, full },
+		{ s_rules_FILL, full },
+		{ s_rules_STROKE, full },
+		{ s_rules_NONE, "both:a;both:b;both:c;both:d;center:Hello Hi;" }
+	};
+	extract_t            *extract;
+	extract_astring_t     content;
+	extract_astring_t     summary;
+	extract_page_stats_t  stats;
+	int                   i;
+	int                   max_tablelines;
+
+	printf("testing table lines from fill and stroke paths:\n");
+	extract_astring_init(&content);
+	extract_astring_init(&summary);
+	for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); ++i)
+	{
+		s_check_e(extract_begin(NULL, extract_format_DOCX, &extract), "extract_begin()");
+		s_check_e(s_add_table_page_ruled(extract, tests[i].rules), "s_add_table_page_ruled()");
+		s_check_e(s_process(extract, &content), "extract_process()");
+		s_check_e(s_docx_summary(content.chars, &summary), "s_docx_summary()");
+		s_check_text(summary.chars, tests[i].expected, "table from paths");
+		extract_end(&extract);
+
+		if (tests[i].rules == s_rules_NONE) continue;
+
+		/* Use page limits to check that exactly six table lines were found,
+		so none of the paths that are not thin rectangles were used. */
+		for (max_tablelines = 5; max_tablelines <= 6; ++max_tablelines)
+		{
+			s_check_e(extract_begin(NULL, extract_format_DOCX, &extract), "extract_begin()");
+			s_check_e(extract_set_page_limits(extract, 0, max_tablelines, 0), "extract_set_page_limits()");
+			s_check_e(s_add_table_page_ruled(extract, tests[i].rules), "s_add_table_page_ruled()");
+			s_check_e(s_process(extract, &content), "extract_process()");
+			s_check_e(extract_get_page_stats(extract, &stats), "extract_get_page_stats()");
+			if (stats.pages_degraded_tablelines != (max_tablelines < 6))
+			{
+				s_num_fails += 1;
+				printf("Error: test %i: max_tablelines=%i pages_degraded_tablelines=%i\n",
+						i, max_tablelines, stats.pages_degraded_tablelines);
+			}
+			extract_end(&extract);
+		}
+	}
+	extract_astring_free(NULL, &summary);
+	extract_astring_free(NULL, &content);
+}
+
+/* Makes extract_process() run out of time at a particular stage. */
+typedef struct
+{
+	extract_progress_stage_t stage;
+	double                   seconds;
+} s_stall_t;
+
+/* extract_progress_fn that waits for <handle>->seconds when reporting
+<handle>->stage. */
+static int s_stall(void *handle, extract_progress_stage_t stage, int n, int n_max)
+{
+	s_stall_t *stall = handle;
+	double     end;
+
+	(void) n;
+	(void) n_max;
+	if (stage != stall->stage) return 0;
+	end = extract_clock() + stall->seconds;
+	while (extract_clock() < end)
+	{
+	}
+	return 0;
+}
+
+static void s_check_page_limits(void)
+{
+	static const char full[] = "table{both:a;both:b;both:c;both:d;}center:Hello Hi;";
+	static const char fast[] = "left:a;left:b;left:c;left:d;left:Hello Hi;";
+	static const struct
+	{
+		int                       max_spans;
+		int                       max_tablelines;
+		double                    max_seconds;
+		extract_progress_stage_t  stall_stage;
+		int                       layout_analysis;
+		const char               *expected;
+		extract_page_stats_t      expected_stats;
+	} tests[] =
+	{
+		/* The page has 6 spans and 6 table lines. */
+		{ 6, 6, 0, extract_progress_ANALYSE, 0, full, {0, 0, 0} },
+		{ 5, 0, 0, extract_progress_ANALYSE, 0, fast, {1, 0, 0} },
+		{ 0, 5, 0, extract_progress_ANALYSE, 0, fast, {0, 1, 0} },
+		{ 5, 5, 0, extract_progress_ANALYSE, 0, fast, {1, 1, 0} },
+		/* Run out of time in extract_page_analyse(), which leaves no time
+		for anything else. */
+		{ 0, 0, 0.001, extract_progress_ANALYSE, 1, fast, {0, 0, 1} },
+		/* Run out of time in table_find(). */
+		{ 0, 0, 0.001, extract_progress_TABLES, 0, fast, {0, 0, 1} },
+		/* Run out of time in make_lines() and make_paragraphs(), after the
+		table and its cells have been found. */
+		{ 0, 0, 0.001, extract_progress_PARAGRAPHS, 0, "table{both:a;both:b;both:c;both:d;}left:Hello Hi;", {0, 0, 1} }
+	};
+	extract_t            *extract;
+	extract_astring_t     content;
+	extract_astring_t     summary;
+	extract_page_stats_t  stats;
+	s_stall_t             stall;
+	int                   i;
+
+	printf("testing extract_set_page_limits():\n");
+	if (extract_clock() < 0)
+	{
+		printf("no clock, not testing.\n");
+		return;
+	}
+	extract_astring_init(&content);
+	extract_astring_init(&summary);
+	for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); ++i)
+	{
+		/* With a time limit, stall for longer than the limit. */
+		stall.stage = tests[i].stall_stage;
+		stall.seconds = (tests[i].max_seconds > 0) ? 0.02 : 0;
+		s_check_e(extract_begin(NULL, extract_format_DOCX, &extract), "extract_begin()");
+		s_check_e(extract_set_layout_analysis(extract, tests[i].layout_analysis), "extract_set_layout_analysis()");
+		s_check_e(extract_set_page_limits(extract, tests[i].max_spans, tests[i].max_tablelines, tests[i].max_seconds), "extract_set_page_limits()");
+		s_check_e(extract_set_progress_fn(extract, s_stall, &stall), "extract_set_progress_fn()");
+		s_check_e(s_add_table_page(extract), "s_add_table_page()");
+		s_check_e(s_process(extract, &content), "extract_process()");
+		s_check_e(s_docx_summary(content.chars, &summary), "s_docx_summary()");
+		s_check_text(summary.chars, tests[i].expected, "output with page limits");
+		s_check_e(extract_get_page_stats(extract, &stats), "extract_get_page_stats()");
+		if (stats.pages_degraded_spans != tests[i].expected_stats.pages_degraded_spans
+				|| stats.pages_degraded_tablelines != tests[i].expected_stats.pages_degraded_tablelines
+				|| stats.pages_degraded_time != tests[i].expected_stats.pages_degraded_time)
+		{
+			s_num_fails += 1;
+			printf("Error: test %i: page stats are %i %i %i\n", i,
+					stats.pages_degraded_spans, stats.pages_degraded_tablelines, stats.pages_degraded_time);
+		}
+		extract_end(&extract);
+	}
+	extract_astring_free(NULL, &summary);
+	extract_astring_free(NULL, &content);
+}
+
+static void s_check_cull(void)
+{
+	extract_t         *extract;
+	extract_astring_t  content;
+	int                cull;
+
+	printf("testing culling of chars outside the mediabox and clip rect:\n");
+	extract_astring_init(&content);
+	for (cull = 0; cull < 2; ++cull)
+	{
+		/* 'A' is visible, 'B' is inside the mediabox but outside the clip
+		rect, 'C' is outside the mediabox, and 'D' has only its bbox inside
+		the clip rect. */
+		s_check_e(extract_begin(NULL, extract_format_TEXT, &extract), "extract_begin()");
+		s_check_e(extract_set_cull_invisible(extract, cull), "extract_set_cull_invisible()");
+		s_check_e(extract_page_begin(extract, 0, 0, 200, 200), "extract_page_begin()");
+		s_check_e(extract_set_clip(extract, 0, 0, 150, 200), "extract_set_clip()");
+		s_check_e(s_add_char_span(extract, 10, 10, 'A'), "adding A");
+		s_check_e(s_add_char_span(extract, 160, 70, 'B'), "adding B");
+		s_check_e(s_add_char_span(extract, 250, 130, 'C'), "adding C");
+		s_check_e(s_add_char_span(extract, 145, 190, 'D'), "adding D");
+		s_check_e(extract_page_end(extract), "extract_page_end()");
+		s_check_e(s_process(extract, &content), "extract_process()");
+		s_check_text(content.chars, cull ? "A\nD\n" : "A\nB\nC\nD\n", "culled chars");
+		extract_end(&extract);
+	}
+
+	/* A clip rect set before extract_read_intermediate() applies to the
+	pages that it reads, so only "Hi" and its overprint are kept. */
+	s_check_e(extract_begin(NULL, extract_format_TEXT, &extract), "extract_begin()");
+	s_check_e(extract_set_cull_invisible(extract, 1), "extract_set_cull_invisible()");
+	s_check_e(extract_set_clip(extract, 0, 0, 109, 200), "extract_set_clip()");
+	s_check_e(s_read_intermediate(extract, s_overprint_xml), "extract_read_intermediate()");
+	s_check_e(s_process(extract, &content), "extract_process()");
+	s_check_text(content.chars, "HiHi\n", "chars culled from intermediate data");
+	extract_end(&extract);
+	extract_astring_free(NULL, &content);
+}
+
+static void *s_realloc(void *state, void *prev, size_t size)
+{
+	(void) state;
+	if (size == 0)
+	{
+		free(prev);
+		return NULL;
+	}
+	return realloc(prev, size);
+}
+
+/* extract_realloc_fn_t that counts live blocks in *(int*) state. */
+static void *s_realloc_count(void *state, void *prev, size_t size)
+{
+	int  *live = state;
+	void *p;
+
+	if (size == 0)
+	{
+		if (prev) *live -= 1;
+		free(prev);
+		return NULL;
+	}
+	p = realloc(prev, size);
+	if (p && !prev) *live += 1;
+	return p;
+}
+
+/* Cancels processing at the <cancel_at>'th progress callback, counting from
+zero. */
+typedef struct
+{
+	int n;
+	int cancel_at;
+} s_cancel_t;
+
+static int s_cancel(void *handle, extract_progress_stage_t stage, int n, int n_max)
+{
+	s_cancel_t *cancel = handle;
+
+	(void) stage;
+	(void) n;
+	(void) n_max;
+	return (cancel->n++ == cancel->cancel_at);
+}
+
+/* Processes and writes a two-page docx document, with cancellation at
+<cancel_at>. Returns the number of progress callbacks. */
+static int s_check_cancel_at(int cancel_at)
+{
+	extract_alloc_t   *alloc;
+	extract_t         *extract;
+	extract_buffer_t  *buffer;
+	extract_astring_t  out;
+	s_cancel_t         cancel;
+	int                live = 0;
+	int                e;
+
+	cancel.n = 0;
+	cancel.cancel_at = cancel_at;
+	extract_astring_init(&out);
+	s_check_e(extract_alloc_create(s_realloc_count, &live, &alloc), "extract_alloc_create()");
+	s_check_e(extract_begin(alloc, extract_format_DOCX, &extract), "extract_begin()");
+	s_check_e(extract_set_layout_analysis(extract, 1), "extract_set_layout_analysis()");
+	s_check_e(extract_set_progress_fn(extract, s_cancel, &cancel), "extract_set_progress_fn()");
+	s_check_e(s_add_table_page(extract), "s_add_table_page()");
+	s_check_e(s_add_table_page(extract), "s_add_table_page()");
+	e = extract_process(extract, 0 /*spacing*/, 0 /*rotation*/, 1 /*images*/);
+	if (!e)
+	{
+		s_check_e(extract_buffer_open(alloc, &out, NULL /*fn_read*/, s_write_astring, NULL /*fn_cache*/, NULL /*fn_close*/, &buffer), "extract_buffer_open()");
+		e = extract_write(extract, buffer);
+		s_check_e(extract_buffer_close(&buffer), "extract_buffer_close()");
+	}
+	if (cancel_at < 0)
+		s_check_e(e, "extract_process() and extract_write() without cancelling");
+	else if (e != -1 || errno != ECANCELED)
+	{
+		s_num_fails += 1;
+		printf("Error: cancel_at=%i: e=%i errno=%i\n", cancel_at, e, errno);
+	}
+	extract_end(&extract);
+	if (live != 1)
+	{
+		/* Only the extract_alloc_t itself should be left. */
+		s_num_fails += 1;
+		printf("Error: cancel_at=%i: %i blocks still allocated after extract_end()\n", cancel_at, live - 1);
+	}
+	extract_alloc_destroy(&alloc);
+	extract_astring_free(NULL, &out);
+	return cancel.n;
+}
+
+static void s_check_cancel(void)
+{
+	int n;
+	int i;
+
+	printf("testing cancellation with extract_set_progress_fn():\n");
+	n = s_check_cancel_at(-1);
+	printf("    %i progress callbacks.\n", n);
+	for (i = 0; i < n; ++i)
+	{
+		s_check_cancel_at(i);
+	}
+}
+
+static char s_image_x[] = "image x data";
+static char s_image_y[] = "image y data";
+
+/* Adds a page with some text and image X. */
+static int s_add_document_a(extract_t *extract)
+{
+	if (extract_page_begin(extract, 0, 0, 600, 800)) return -1;
+	if (s_add_text(extract, 100, 100, "One")) return -1;
+	if (extract_add_image(extract, "png", 100, 0, 0, 100, 100, 200, 100, 100, s_image_x, sizeof(s_image_x), NULL, NULL)) return -1;
+	return extract_page_end(extract);
+}
+
+/* Adds the table page, then a page with image X from s_add_document_a(),
+image Y and image X again. */
+static int s_add_document_b(extract_t *extract)
+{
+	if (s_add_table_page(extract)) return -1;
+	if (extract_page_begin(extract, 0, 0, 600, 800)) return -1;
+	if (s_add_text(extract, 100, 100, "Two")) return -1;
+	if (extract_add_image(extract, "png", 100, 0, 0, 100, 100, 200, 100, 100, s_image_x, sizeof(s_image_x), NULL, NULL)) return -1;
+	if (extract_add_image(extract, "png", 100, 0, 0, 100, 100, 400, 100, 100, s_image_y, sizeof(s_image_y), NULL, NULL)) return -1;
+	if (extract_add_image(extract, "png", 100, 0, 0, 100, 100, 600, 100, 100, s_image_x, sizeof(s_image_x), NULL, NULL)) return -1;
+	return extract_page_end(extract);
+}
+
+/* Processes <extract> and writes it as a docx file into <out>, which is
+emptied first. */
+static int s_process_write(extract_t *extract, extract_astring_t *out)
+{
+	extract_buffer_t *buffer;
+	int               e;
+
+	extract_astring_clear(out);
+	if (extract_process(extract, 0 /*spacing*/, 0 /*rotation*/, 1 /*images*/)) return -1;
+	if (extract_buffer_open(NULL, out, NULL /*fn_read*/, s_write_astring, NULL /*fn_cache*/, NULL /*fn_close*/, &buffer)) return -1;
+	e = extract_write(extract, buffer);
+	if (extract_buffer_close(&buffer)) e = -1;
+	return e;
+}
+
+static int s_astrings_equal(const extract_astring_t *a, const extract_astring_t *b)
+{
+	return a->chars_num == b->chars_num && !memcmp(a->chars, b->chars, a->chars_num);
+}
+
+/* Writes document B with a new extract_t into <fresh>, and after
+document A and extract_reset() into <reused>. If <cancel_at> is not -1, the
+first run of document A is cancelled at that progress callback. */
+static void s_reset_run(int cancel_at, extract_astring_t *fresh, extract_astring_t *reused)
+{
+	extract_t  *extract;
+	s_cancel_t  cancel;
+	int         e;
+
+	s_check_e(extract_begin(NULL, extract_format_DOCX, &extract), "extract_begin()");
+	s_check_e(s_add_document_b(extract), "s_add_document_b()");
+	s_check_e(s_process_write(extract, fresh), "s_process_write() fresh");
+	extract_end(&extract);
+
+	cancel.n = 0;
+	cancel.cancel_at = cancel_at;
+	s_check_e(extract_begin(NULL, extract_format_DOCX, &extract), "extract_begin()");
+	s_check_e(extract_set_progress_fn(extract, s_cancel, &cancel), "extract_set_progress_fn()");
+	s_check_e(s_add_document_a(extract), "s_add_document_a()");
+	e = s_process_write(extract, reused);
+	if (cancel_at < 0)
+		s_check_e(e, "s_process_write() document A");
+	else
+		s_check_e(e != -1 || errno != ECANCELED, "s_process_write() document A is cancelled");
+	s_check_e(extract_reset(extract), "extract_reset()");
+	s_check_e(extract_set_progress_fn(extract, NULL, NULL), "extract_set_progress_fn()");
+	s_check_e(s_add_document_b(extract), "s_add_document_b()");
+	s_check_e(s_process_write(extract, reused), "s_process_write() after extract_reset()");
+	extract_end(&extract);
+}
+
+static void s_check_reset(void)
+{
+	/* Cancel in extract_process(), in extract_write(), or not at all. */
+	static const int   cancel_ats[] = { -1, 0, 3 };
+	extract_astring_t  fresh;
+	extract_astring_t  reused;
+	int                i;
+
+	printf("testing extract_reset():\n");
+	extract_astring_init(&fresh);
+	extract_astring_init(&reused);
+	for (i = 0; i < (int) (sizeof(cancel_ats) / sizeof(cancel_ats[0])); ++i)
+	{
+		s_reset_run(cancel_ats[i], &fresh, &reused);
+		if (!s_astrings_equal(&fresh, &reused))
+		{
+			/* The zip entries' timestamps have a resolution of two
+			seconds, so we could have crossed a boundary; try again. */
+			s_reset_run(cancel_ats[i], &fresh, &reused);
+		}
+		if (!s_astrings_equal(&fresh, &reused))
+		{
+			s_num_fails += 1;
+			printf("Error: cancel_at=%i: docx after extract_reset() differs from docx from new extract_t\n", cancel_ats[i]);
+		}
+	}
+	extract_astring_free(NULL, &reused);
+	extract_astring_free(NULL, &fresh);
+}
+
+static void s_check_pool(void)
+{
+	extract_alloc_t   *alloc;
+	extract_t         *extract;
+	extract_astring_t  content[2];
+	int                pool;
+
+	printf("testing content tree allocated from pools:\n");
+	for (pool = 0; pool < 2; ++pool)
+	{
+		extract_astring_init(&content[pool]);
+		s_check_e(extract_alloc_create(s_realloc, NULL, &alloc), "extract_alloc_create()");
+		s_check_e(extract_alloc_pool(alloc, pool), "extract_alloc_pool()");
+		s_check_e(extract_begin(alloc, extract_format_TEXT, &extract), "extract_begin()");
+		s_check_e(s_read_intermediate(extract, s_overprint_xml), "extract_read_intermediate()");
+		s_check_e(s_process(extract, &content[pool]), "extract_process()");
+		extract_end(&extract);
+		/* This fails if extract_end() leaked any pooled blocks. */
+		s_check_e(extract_alloc_pool(alloc, 0), "extract_alloc_pool() disable after extract_end()");
+		extract_alloc_destroy(&alloc);
+	}
+	s_check_text(content[1].chars, content[0].chars, "pooled output");
+	extract_astring_free(NULL, &content[0]);
+	extract_astring_free(NULL, &content[1]);
+}
+
+
+#if defined(BUILD_MONOLITHIC)
+#define main(v)      extract_extract_test_main(v)
+#endif
+
+int main(void)
+{
+	s_check_overprint_intermediate();
+	s_check_pool();
+	s_check_cull();
+	s_check_profiles();
+	s_check_paths();
+	s_check_rotation_classes();
+	s_check_page_limits();
+	s_check_cancel();
+	s_check_reset();
+
+	printf("s_num_fails=%i\n", s_num_fails);
+
+	if (s_num_fails) {
+		printf("Failed\n");
+		return EXIT_FAILURE;
+	}
+	else {
+		printf("Succeeded\n");
+		return EXIT_SUCCESS;
+	}
+}
@@ -11,12 +11,14 @@
 #include "odt.h"
 #include "odt_template.h"
 #include "outf.h"
+#include "styles.h"
 #include "xml.h"
 #include "zip.h"
 
 
 #include <assert.h>
 #include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -54,13 +56,44 @@ matrix4_t extract_matrix4_invert(const matrix4_t *ctm)
 	return ctm_inverse;
 }
 
+/* Converts <v> to char_coord_t, clamping values that are out of range, such as
+the ones in extract_rect_empty. */
+static char_coord_t char_coord(double v)
+{
+#ifdef EXTRACT_COMPACT_CHARS
+	if (v > FLT_MAX)    return FLT_MAX;
+	if (v < -FLT_MAX)   return -FLT_MAX;
+	return (float) v;
+#else
+	return v;
+#endif
+}
+
+rect_t extract_char_bbox(const char_t *char_)
+{
+	rect_t bbox;
+	bbox.min.x = char_->bbox.min_x;
+	bbox.min.y = char_->bbox.min_y;
+	bbox.max.x = char_->bbox.max_x;
+	bbox.max.y = char_->bbox.max_y;
+	return bbox;
+}
+
+void extract_char_set(char_t *char_, double x, double y, double adv, rect_t bbox)
+{
+	char_->x = char_coord(x);
+	char_->y = char_coord(y);
+	char_->adv = char_coord(adv);
+	char_->bbox.min_x = char_coord(bbox.min.x);
+	char_->bbox.min_y = char_coord(bbox.min.y);
+	char_->bbox.max_x = char_coord(bbox.max.x);
+	char_->bbox.max_y = char_coord(bbox.max.y);
+}
+
 static void char_init(char_t* item)
 {
-	item->x = 0;
-	item->y = 0;
 	item->ucs = 0;
-	item->adv = 0;
-	item->bbox = extract_rect_empty;
+	extract_char_set(item, 0, 0, 0, extract_rect_empty);
 }
 
 const char *extract_point_string(const point_t *point)
@@ -158,12 +191,50 @@ char_t *extract_span_append_c(extract_alloc_t *alloc, span_t *span, int c)
 	}
 	item = &span->chars[span->chars_num];
 	span->chars_num += 1;
+	span->bbox_chars_num = -1;
 	char_init(item);
 	item->ucs = c;
 
 	return item;
 }
 
+void extract_span_geometry_init(span_t *span)
+{
+	point_t dir = { 1 - span->flags.wmode, span->flags.wmode };
+
+	span->dir = extract_matrix4_transform_point(span->ctm, dir);
+	span->scale_squared = span->dir.x * span->dir.x + span->dir.y * span->dir.y;
+
+	/* Classes are centred on multiples of 360/extract_span_ROTATION_CLASSES
+	degrees, so that the common axis-aligned directions are never near a
+	class boundary. */
+	if (span->scale_squared > 0 && span->scale_squared < DBL_MAX)
+	{
+		double turns = atan2(span->dir.y, span->dir.x) / (2 * 3.14159265358979323846);
+		int    c     = (int) floor(turns * extract_span_ROTATION_CLASSES + 0.5);
+		span->rotation_class = c & (extract_span_ROTATION_CLASSES - 1);
+	}
+	else
+	{
+		span->rotation_class = -1;
+	}
+}
+
+rect_t extract_span_bbox(span_t *span)
+{
+	int i;
+
+	if (span->bbox_chars_num != span->chars_num)
+	{
+		span->bbox = extract_rect_empty;
+		for (i = 0; i < span->chars_num; i++)
+			span->bbox = extract_rect_union(span->bbox, extract_char_bbox(&span->chars[i]));
+		span->bbox_chars_num = span->chars_num;
+	}
+
+	return span->bbox;
+}
+
 char_t *extract_span_char_last(span_t *span)
 {
 	assert(span->chars_num > 0);
@@ -205,7 +276,7 @@ void extract_paragraph_free(extract_alloc_t *alloc, paragraph_t **pparagraph)
 
 	content_unlink(&paragraph->base);
 	content_clear(alloc, &paragraph->content);
-	extract_free(alloc, pparagraph);
+	extract_free_pooled(alloc, pparagraph, sizeof(**pparagraph));
 }
 
 void extract_block_free(extract_alloc_t *alloc, block_t **pblock)
@@ -217,7 +288,7 @@ void extract_block_free(extract_alloc_t *alloc, block_t **pblock)
 
 	content_unlink(&block->base);
 	content_clear(alloc, &block->content);
-	extract_free(alloc, pblock);
+	extract_free_pooled(alloc, pblock, sizeof(**pblock));
 }
 
 void extract_table_free(extract_alloc_t *alloc, table_t **ptable)
@@ -328,7 +399,7 @@ int content_new_root(extract_alloc_t *alloc, content_root_t **proot)
 
 int content_new_span(extract_alloc_t *alloc, span_t **pspan, structure_t *structure)
 {
-	if (extract_malloc(alloc, pspan, sizeof(**pspan))) return -1;
+	if (extract_malloc_pooled(alloc, pspan, sizeof(**pspan))) return -1;
 	extract_span_init(*pspan, structure);
 
 	return 0;
@@ -336,7 +407,7 @@ int content_new_span(extract_alloc_t *alloc, span_t **pspan, structure_t *struct
 
 int content_new_line(extract_alloc_t *alloc, line_t **pline)
 {
-	if (extract_malloc(alloc, pline, sizeof(**pline))) return -1;
+	if (extract_malloc_pooled(alloc, pline, sizeof(**pline))) return -1;
 	extract_line_init(*pline);
 
 	return 0;
@@ -344,7 +415,7 @@ int content_new_line(extract_alloc_t *alloc, line_t **pline)
 
 int content_new_paragraph(extract_alloc_t *alloc, paragraph_t **pparagraph)
 {
-	if (extract_malloc(alloc, pparagraph, sizeof(**pparagraph))) return -1;
+	if (extract_malloc_pooled(alloc, pparagraph, sizeof(**pparagraph))) return -1;
 	extract_paragraph_init(*pparagraph);
 
 	return 0;
@@ -352,7 +423,7 @@ int content_new_paragraph(extract_alloc_t *alloc, paragraph_t **pparagraph)
 
 int content_new_block(extract_alloc_t *alloc, block_t **pblock)
 {
-	if (extract_malloc(alloc, pblock, sizeof(**pblock))) return -1;
+	if (extract_malloc_pooled(alloc, pblock, sizeof(**pblock))) return -1;
 	extract_block_init(*pblock);
 
 	return 0;
@@ -440,21 +511,6 @@ void content_replace(content_t *current, content_t *replacement)
 	current->next = NULL;
 }
 
-static content_root_t *
-content_parent(content_root_t *content)
-{
-	content_t *parent = content->parent;
-	content_t *c = parent;
-	if (parent == NULL)
-		return NULL;
-	while (c->type != content_root)
-	{
-		assert(c->next != parent);
-		c = c->next;
-	}
-	return (content_root_t *)c;
-}
-
 /* Replaces current element with a new empty paragraph content; returns -1 with errno set on error. */
 int content_replace_new_paragraph(extract_alloc_t *alloc, content_t *current, paragraph_t **pparagraph)
 {
@@ -482,32 +538,131 @@ int content_replace_new_line(extract_alloc_t *alloc, content_t *current, line_t
 	return 0;
 }
 
-static void extract_images_free(extract_alloc_t *alloc, images_t *images)
+/* Frees all images, keeping the allocated arrays. */
+static void extract_images_clear(extract_alloc_t *alloc, images_t *images)
 {
 	int i;
 	for (i=0; i<images->images_num; ++i) {
 		extract_image_clear(alloc, images->images[i]);
 		extract_free(alloc, &images->images[i]);
 	}
-	extract_free(alloc, &images->images);
-	extract_free(alloc, &images->imagetypes);
 	images->images_num = 0;
 	images->imagetypes_num = 0;
+	for (i=0; i<images->imagetypes_hash_num; ++i)
+		images->imagetypes_hash[i] = -1;
 }
 
+static void extract_images_free(extract_alloc_t *alloc, images_t *images)
+{
+	extract_images_clear(alloc, images);
+	extract_free(alloc, &images->images);
+	extract_free(alloc, &images->imagetypes);
+	extract_free(alloc, &images->imagetypes_hash);
+	images->images_max = 0;
+	images->imagetypes_max = 0;
+	images->imagetypes_hash_num = 0;
+}
+
+/* Returns index of slot in images->imagetypes_hash[] that refers to <type>,
+or of the empty slot where it should go. images->imagetypes_hash_num must be
+non-zero. */
+static int imagetypes_find(images_t *images, const char *type)
+{
+	unsigned mask = (unsigned) images->imagetypes_hash_num - 1;
+	unsigned i = extract_hash(extract_hash_START, type, strlen(type)) & mask;
+
+	for (;;)
+	{
+		int it = images->imagetypes_hash[i];
+
+		if (it < 0) return (int) i;
+		if (!strcmp(images->imagetypes[it], type)) return (int) i;
+		i = (i + 1) & mask;
+	}
+}
+
+static int imagetypes_rehash(extract_alloc_t *alloc, images_t *images, int hash_num)
+{
+	int i;
+
+	extract_free(alloc, &images->imagetypes_hash);
+	if (extract_malloc(alloc, &images->imagetypes_hash, sizeof(*images->imagetypes_hash) * hash_num))
+	{
+		images->imagetypes_hash_num = 0;
+		return -1;
+	}
+	images->imagetypes_hash_num = hash_num;
+	for (i=0; i<hash_num; ++i)
+		images->imagetypes_hash[i] = -1;
+	for (i=0; i<images->imagetypes_num; ++i)
+		images->imagetypes_hash[imagetypes_find(images, images->imagetypes[i])] = i;
+
+	return 0;
+}
+
+/* Moves <image> out of its content list into <images>, and records its type
+if we haven't seen it before. On error, <image> is left in its content list
+if it has not yet been moved. */
+static int images_append(extract_alloc_t *alloc, images_t *images, image_t *image)
+{
+	int slot;
+
+	if (images->images_num == images->images_max)
+	{
+		int images_max = images->images_max ? images->images_max * 2 : 32;
+		if (extract_realloc2(
+				alloc,
+				&images->images,
+				sizeof(*images->images) * images->images_max,
+				sizeof(*images->images) * images_max
+				)) return -1;
+		images->images_max = images_max;
+	}
+	content_unlink(&image->base);
+	images->images[images->images_num] = image;
+	images->images_num += 1;
 
-/* Move image_t's from document->subpage[] to *o_images.
+	/* Keep load factor at most 1/2. */
+	if ((images->imagetypes_num + 1) * 2 > images->imagetypes_hash_num)
+	{
+		if (imagetypes_rehash(alloc, images, images->imagetypes_hash_num ? images->imagetypes_hash_num * 2 : 16)) return -1;
+	}
+	assert(image->type);
+	slot = imagetypes_find(images, image->type);
+	if (images->imagetypes_hash[slot] >= 0) return 0;
+
+	/* We haven't seen this image type before. */
+	if (images->imagetypes_num == images->imagetypes_max)
+	{
+		int imagetypes_max = images->imagetypes_max ? images->imagetypes_max * 2 : 8;
+		if (extract_realloc2(
+				alloc,
+				&images->imagetypes,
+				sizeof(*images->imagetypes) * images->imagetypes_max,
+				sizeof(*images->imagetypes) * imagetypes_max
+				)) return -1;
+		images->imagetypes_max = imagetypes_max;
+	}
+	images->imagetypes[images->imagetypes_num] = image->type;
+	images->imagetypes_hash[slot] = images->imagetypes_num;
+	images->imagetypes_num += 1;
+	outf("have added images->imagetypes_num=%i", images->imagetypes_num);
+
+	return 0;
+}
+
+
+/* Move image_t's from document->subpage[] to *images, appending to any
+images from earlier calls.
 
 On return document->subpage[].images* will be NULL etc.
 */
 static int
-extract_document_images(extract_alloc_t *alloc, document_t *document, images_t *o_images)
+extract_document_images(extract_alloc_t *alloc, document_t *document, images_t *images)
 {
-	int     e = -1;
-	int      p;
-	images_t images = {0};
+	int p;
 
-	outf("extract_document_images(): images.images_num=%i", images.images_num);
+	outf("extract_document_images(): images->images_num=%i", images->images_num);
 	for (p=0; p<document->pages_num; ++p)
 	{
 		extract_page_t *page = document->pages[p];
@@ -521,60 +676,17 @@ extract_document_images(extract_alloc_t *alloc, document_t *document, images_t *
 
 			for (i = 0, image = content_image_iterator_init(&iit, &subpage->content); image != NULL; i++, image = content_image_iterator_next(&iit))
 			{
-				if (extract_realloc2(alloc,
-						 &images.images,
-						 sizeof(image_t) * images.images_num,
-						 sizeof(image_t) * (images.images_num + 1))) goto end;
+				/* Duplicates share an earlier image's archive entry, so are
+				left in the page content and freed with the page. */
+				if (image->duplicate) continue;
 				outf("p=%i i=%i image->name=%s image->id=%s", p, i, image->name, image->id);
 				assert(image->name);
-				content_unlink(&image->base);
-				images.images[images.images_num] = image;
-				images.images_num += 1;
-
-				/* Add image type if we haven't seen it before. */
-				{
-					int it;
-					for (it=0; it<images.imagetypes_num; ++it)
-					{
-						outf("it=%i images.imagetypes[it]=%s image->type=%s",
-							it, images.imagetypes[it], image->type);
-						if (!strcmp(images.imagetypes[it], image->type))
-						{
-							break;
-						}
-					}
-					if (it == images.imagetypes_num)
-					{
-						/* We haven't seen this image type before. */
-						if (extract_realloc2(
-								alloc,
-								&images.imagetypes,
-								sizeof(char*) * images.imagetypes_num,
-								sizeof(char*) * (images.imagetypes_num + 1)
-							)) goto end;
-						assert(image->type);
-						images.imagetypes[images.imagetypes_num] = image->type;
-						images.imagetypes_num += 1;
-						outf("have added images.imagetypes_num=%i", images.imagetypes_num);
-					}
-				}
+				if (images_append(alloc, images, image)) return -1;
 			}
 		}
 	}
 
-	e = 0;
-end:
-
-	if (e)
-	{
-		extract_free(alloc, &images.images);
-	}
-	else
-	{
-		*o_images = images;
-	}
-
-	return e;
+	return 0;
 }
 
 static void extract_document_free(extract_alloc_t *alloc, document_t *document)
@@ -591,6 +703,8 @@ static void extract_document_free(extract_alloc_t *alloc, document_t *document)
 	document->pages = NULL;
 	document->pages_num = 0;
 
+	extract_fonts_free(alloc, &document->fonts);
+
 	structure_clear(alloc, document->structure);
 }
 
@@ -664,25 +778,93 @@ matrix4_t extract_multiply_matrix4_matrix4(matrix4_t m1, matrix4_t m2)
 
 static int s_matrix_read(const char *text, matrix_t *matrix)
 {
-	int n;
+	double *values[6];
+	char   *end;
+	int     i;
 
 	if (!text) {
 		outf("text is NULL in s_matrix_read()");
 		errno = EINVAL;
 		return -1;
 	}
-	n = sscanf(text,
-			   "%lf %lf %lf %lf %lf %lf",
-			   &matrix->a,
-			   &matrix->b,
-			   &matrix->c,
-			   &matrix->d,
-			   &matrix->e,
-			   &matrix->f);
-	if (n != 6) {
-		errno = EINVAL;
+	values[0] = &matrix->a;
+	values[1] = &matrix->b;
+	values[2] = &matrix->c;
+	values[3] = &matrix->d;
+	values[4] = &matrix->e;
+	values[5] = &matrix->f;
+	for (i=0; i<6; ++i)
+	{
+		while (*text == ' ') text += 1;
+		*values[i] = extract_xml_strtod(text, &end);
+		if (end == text) {
+			errno = EINVAL;
+			return -1;
+		}
+		text = end;
+	}
+
+	return 0;
+}
+
+/* Finds the values of the attributes in <names> with a single pass over
+<tag>'s attributes. Sets o_values[i] to NULL if names[i] is not present. */
+static void s_attributes_get(
+		extract_xml_tag_t  *tag,
+		const char * const *names,
+		int                 names_num,
+		const char        **o_values)
+{
+	int i;
+	int j;
+
+	for (j=0; j<names_num; ++j)
+		o_values[j] = NULL;
+	for (i=0; i<tag->attributes_num; ++i)
+	{
+		for (j=0; j<names_num; ++j)
+		{
+			if (!strcmp(tag->attributes[i].name, names[j]))
+			{
+				o_values[j] = tag->attributes[i].value;
+				break;
+			}
+		}
+	}
+}
+
+/* Reads attributes of a <char> tag in a single pass. */
+static int s_char_read(
+		extract_xml_tag_t *tag,
+		double            *o_x,
+		double            *o_y,
+		double            *o_adv,
+		unsigned          *o_ucs)
+{
+	const char *x = NULL;
+	const char *y = NULL;
+	const char *adv = NULL;
+	const char *ucs = NULL;
+	int         i;
+
+	for (i=0; i<tag->attributes_num; ++i)
+	{
+		const char *name = tag->attributes[i].name;
+		const char *value = tag->attributes[i].value;
+		if      (name[0] == 'x' && name[1] == 0) x = value;
+		else if (name[0] == 'y' && name[1] == 0) y = value;
+		else if (!strcmp(name, "adv"))           adv = value;
+		else if (!strcmp(name, "ucs"))           ucs = value;
+	}
+	if (!x || !y || !adv || !ucs) {
+		outf("Failed to find attribute in <char>");
+		errno = ESRCH;
 		return -1;
 	}
+	if (extract_xml_str_to_double(x, o_x)) return -1;
+	if (extract_xml_str_to_double(y, o_y)) return -1;
+	if (extract_xml_str_to_double(adv, o_adv)) return -1;
+	if (extract_xml_str_to_uint(ucs, o_ucs)) return -1;
 
 	return 0;
 }
@@ -693,10 +875,42 @@ static void document_init(document_t *document)
 	document->pages = NULL;
 	document->pages_num = 0;
 
+	extract_fonts_init(&document->fonts);
+
 	document->structure = NULL;
 	document->current = NULL;
 }
 
+/* Entry in extract_t's hash of unique images. */
+typedef struct
+{
+	unsigned  hash;
+	image_t  *image;  /* NULL if slot is empty. */
+} image_unique_t;
+
+/* The line most recently added to with a particular orientation, used by
+extract_add_char() to find lines while chars are being added. */
+typedef struct
+{
+	int      line_id;       /* Zero if there is no open line. */
+	point_t  end;           /* Predicted end of the last char with non-zero adv. */
+	double   adv;           /* Advance of that char. */
+	point_t  dir;           /* span_t::dir of that char's span. */
+	double   scale_squared; /* span_t::scale_squared of that char's span. */
+} open_line_t;
+
+/* Entry in extract_t's hash of the non-space glyphs on the current subpage,
+keyed on ucs and position quantised to overprint_distance. */
+typedef struct
+{
+	span_t   *span;        /* NULL if slot is empty. */
+	int       char_i;      /* Index of the glyph in span->chars[]. */
+	unsigned  ucs;
+	int       cell_x;
+	int       cell_y;
+	int       overprinted; /* Non-zero if a glyph overprinting this one was dropped. */
+} glyph_t;
+
 /* If we exceed MAX_STRUCT_NEST then this probably indicates that
  * structure nesting is not to be trusted. */
 #define MAX_STRUCT_NEST 64
@@ -705,6 +919,7 @@ struct extract_t
 {
 	extract_alloc_t         *alloc;
 	int                      layout_analysis;
+	extract_profile_t        profile;
 	double                   master_space_guess;
 	document_t               document;
 
@@ -714,22 +929,77 @@ struct extract_t
 	/* Number of extra spans from autosplit=1. */
 	int                      num_spans_autosplit;
 
+	/* Number of extract_span_begin() calls that continued the previous span. */
+	int                      num_spans_continued;
+
+	/* Set by extract_span_begin() when it continues the previous span, until
+	the next char is added. */
+	int                      span_continued;
+
 	/* Only used if autosplit is non-zero. */
 	double                   span_offset_x;
 	double                   span_offset_y;
 
+	/* Open lines on the current subpage, indexed by
+	span_t::flags.wmode * extract_span_ROTATION_CLASSES + span_t::rotation_class. */
+	open_line_t              open_lines[2 * extract_span_ROTATION_CLASSES];
+
+	/* Last id given to a line by extract_add_char(). */
+	int                      line_id_last;
+
+	/* Whether extract_add_char() drops glyphs that overprint an earlier one. */
+	int                      overprint_dedup;
+
+	/* Hash of the glyphs on the current subpage, used to find overprinting
+	glyphs. glyphs_max is zero or a power of two. glyphs_overprinted is
+	non-zero if any entry has .overprinted set. */
+	glyph_t                 *glyphs;
+	int                      glyphs_num;
+	int                      glyphs_max;
+	int                      glyphs_overprinted;
+
+	/* Number of glyphs dropped because they overprinted an earlier one. */
+	int                      num_chars_overprinted;
+
+	/* Whether extract_add_char() drops chars outside <clip> and the page's
+	mediabox. <clip> is reset to extract_rect_infinite by
+	extract_page_begin(), except that extract_read_intermediate() keeps the
+	clip that was set when it was called. */
+	int                      cull_invisible;
+	rect_t                   clip;
+
+	/* Number of chars dropped because they were not visible. */
+	int                      num_chars_culled;
+
+	/* Per-page limits for extract_process(), and counts of the pages that
+	exceeded them. */
+	join_limits_t            page_limits;
+	extract_page_stats_t     page_stats;
+
+	/* Set by extract_set_progress_fn(). */
+	progress_t               progress;
+
 	/* Used to generate unique ids for images. */
 	int                      image_n;
 
+	/* Hash of all non-duplicate images added so far, used to find images
+	with identical data. images_unique_max is zero or a power of two. */
+	image_unique_t          *images_unique;
+	int                      images_unique_num;
+	int                      images_unique_max;
+
 	/* List of strings that are the generated docx content for each page. When
-	 * zip_* can handle appending of data, we will be able to remove this list. */
+	 * zip_* can handle appending of data, we will be able to remove this list.
+	 * Items contentss_num..contentss_max-1 are empty but may have buffers
+	 * left by extract_reset(). */
 	extract_astring_t       *contentss;
 	int                      contentss_num;
+	int                      contentss_max;
 
 	images_t                 images;
 
 	extract_format_t         format;
-	extract_odt_styles_t     odt_styles;
+	extract_styles_t         styles;
 
 	char                    *tables_csv_format;
 	int                      tables_csv_i;
@@ -747,8 +1017,14 @@ struct extract_t
 		{
 			matrix_t ctm;
 			double   color;
-			point_t  points[4];
+			/* Transformed points of the current subpath; a fifth point
+			 * allows for an explicit lineto back to the start. n is -1 if
+			 * the current subpath cannot be a rectangle. */
+			point_t  points[5];
 			int      n;
+			/* Transformed start of the current subpath, which becomes the
+			 * current point after extract_closepath(). */
+			point_t  point0;
 		} fill;
 
 		struct
@@ -804,6 +1080,7 @@ int extract_begin(extract_alloc_t  *alloc,
 	extract->tables_csv_i = 0;
 
 	extract->next_uid = 1;
+	extract->clip = extract_rect_infinite;
 
 	*pextract = extract;
 
@@ -821,6 +1098,77 @@ int extract_set_layout_analysis(extract_t *extract, int enable)
 	return 0;
 }
 
+int extract_set_profile(extract_t *extract, extract_profile_t profile)
+{
+	if (profile != extract_profile_FULL
+			&& profile != extract_profile_BALANCED
+			&& profile != extract_profile_FAST)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	extract->profile = profile;
+	return 0;
+}
+
+int extract_set_overprint_dedup(extract_t *extract, int enable)
+{
+	extract->overprint_dedup = enable;
+	return 0;
+}
+
+int extract_set_cull_invisible(extract_t *extract, int enable)
+{
+	extract->cull_invisible = enable;
+	return 0;
+}
+
+int extract_set_clip(extract_t *extract, double x0, double y0, double x1, double y1)
+{
+	extract->clip.min.x = x0;
+	extract->clip.min.y = y0;
+	extract->clip.max.x = x1;
+	extract->clip.max.y = y1;
+	return 0;
+}
+
+int extract_set_page_limits(extract_t *extract, int max_spans, int max_tablelines, double max_seconds)
+{
+	if (max_spans < 0 || max_tablelines < 0 || !(max_seconds >= 0))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	extract->page_limits.max_spans = max_spans;
+	extract->page_limits.max_tablelines = max_tablelines;
+	extract->page_limits.max_seconds = max_seconds;
+	return 0;
+}
+
+int extract_get_page_stats(extract_t *extract, extract_page_stats_t *o_stats)
+{
+	*o_stats = extract->page_stats;
+	return 0;
+}
+
+int extract_set_progress_fn(extract_t *extract, extract_progress_fn *fn, void *handle)
+{
+	extract->progress.fn = fn;
+	extract->progress.handle = handle;
+	return 0;
+}
+
+int extract_progress(const progress_t *progress, extract_progress_stage_t stage, int n, int n_max)
+{
+	if (progress->fn && progress->fn(progress->handle, stage, n, n_max))
+	{
+		outf("cancelled: stage=%i n=%i n_max=%i", stage, n, n_max);
+		errno = ECANCELED;
+		return -1;
+	}
+	return 0;
+}
+
 int extract_tables_csv_format(extract_t *extract, const char *path_format)
 {
 	return extract_strdup(extract->alloc, path_format, &extract->tables_csv_format);
@@ -839,6 +1187,7 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 	document_t        *document   = &extract->document;
 	char              *image_data = NULL;
 	int                num_spans  = 0;
+	rect_t             clip       = extract->clip;
 	extract_xml_tag_t  tag;
 
 	extract_xml_tag_init(&tag);
@@ -894,19 +1243,29 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 		}
 		outfx("loading spans for page %i...", document->pages_num);
 		if (extract_page_begin(extract, mediabox.min.x, mediabox.min.y, mediabox.max.x, mediabox.max.y)) goto end;
+		/* Intermediate data has no clip information, so use the caller's
+		clip rect for every page. */
+		extract->clip = clip;
 		page = extract->document.pages[extract->document.pages_num-1];
 		if (!page) goto end;
 		subpage = page->subpages[page->subpages_num-1];
 		if (!subpage) goto end;
 
 		for(;;) {
-			if (extract_xml_pparse_next(buffer, &tag)) goto end;
+			/* Hex image data is decoded straight from <buffer>, so we
+			only read a tag's trailing text once we know what it is. */
+			if (extract_xml_pparse_next_tag(buffer, &tag)) goto end;
+			if (strcmp(tag.name, "image") && extract_xml_pparse_text(buffer, &tag)) goto end;
 			if (!strcmp(tag.name, "/page")) {
 				num_spans += content_count_spans(&subpage->content);
 				break;
 			}
 			if (!strcmp(tag.name, "image")) {
-				const char* type = extract_xml_tag_attributes_find(&tag, "type");
+				static const char * const names[] = { "type", "w", "h", "datasize" };
+				const char *values[4];
+				const char *type;
+				s_attributes_get(&tag, names, 4, values);
+				type = values[0];
 				if (!type) {
 					errno = EINVAL;
 					goto end;
@@ -916,8 +1275,9 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 					int w;
 					int h;
 					int y;
-					if (extract_xml_tag_attributes_find_int(&tag, "w", &w)) goto end;
-					if (extract_xml_tag_attributes_find_int(&tag, "h", &h)) goto end;
+					if (extract_xml_pparse_text(buffer, &tag)) goto end;
+					if (extract_xml_str_to_int(values[1], &w)) goto end;
+					if (extract_xml_str_to_int(values[2], &h)) goto end;
 					for (y=0; y<h; ++y) {
 						int yy;
 						if (extract_xml_pparse_next(buffer, &tag)) goto end;
@@ -942,41 +1302,10 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 				}
 				else {
 					/* Compressed. */
-					size_t      image_data_size;
-					const char *c;
-					size_t      i;
-					if (extract_xml_tag_attributes_find_size(&tag, "datasize", &image_data_size)) goto end;
+					size_t image_data_size;
+					if (extract_xml_str_to_size(values[3], &image_data_size)) goto end;
 					if (extract_malloc(extract->alloc, &image_data, image_data_size)) goto end;
-					c = tag.text.chars;
-					for(i=0;;) {
-						int byte = 0;
-						int cc;
-						cc = *c;
-						c += 1;
-						if (cc == ' ' || cc == '\n') continue;
-						if (cc >= '0' && cc <= '9') byte += cc-'0';
-						else if (cc >= 'a' && cc <= 'f') byte += 10 + cc - 'a';
-						else goto compressed_error;
-						byte *= 16;
-
-						cc = *c;
-						c += 1;
-						if (cc >= '0' && cc <= '9') byte += cc-'0';
-						else if (cc >= 'a' && cc <= 'f') byte += 10 + cc - 'a';
-						else goto compressed_error;
-
-						image_data[i] = (char) byte;
-						i += 1;
-						if (i == image_data_size) {
-							break;
-						}
-						continue;
-
-						compressed_error:
-						outf("Unrecognised hex character '%x' at offset %lli in image data", cc, (long long) (c-tag.text.chars));
-						errno = EINVAL;
-						goto end;
-					}
+					if (extract_xml_pparse_hex(buffer, image_data, image_data_size)) goto end;
 					if (extract_add_image(
 							extract,
 							type,
@@ -1013,16 +1342,19 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 			}
 
 			{
-				matrix_t  ctm;
-				matrix_t  trm;
-				char     *font_name;
-				char     *font_name2;
-				int       font_bold;
-				int       font_italic;
-				int       wmode;
-				if (s_matrix_read(extract_xml_tag_attributes_find(&tag, "ctm"), &ctm)) goto end;
-				if (s_matrix_read(extract_xml_tag_attributes_find(&tag, "trm"), &trm)) goto end;
-				font_name = extract_xml_tag_attributes_find(&tag, "font_name");
+				static const char * const names[] = { "ctm", "trm", "font_name", "wmode" };
+				const char *values[4];
+				matrix_t    ctm;
+				matrix_t    trm;
+				const char *font_name;
+				const char *font_name2;
+				int         font_bold;
+				int         font_italic;
+				int         wmode;
+				s_attributes_get(&tag, names, 4, values);
+				if (s_matrix_read(values[0], &ctm)) goto end;
+				if (s_matrix_read(values[1], &trm)) goto end;
+				font_name = values[2];
 				if (!font_name) {
 					outf("Failed to find attribute 'font_name'");
 					goto end;
@@ -1031,7 +1363,7 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 				if (font_name2)  font_name = font_name2 + 1;
 				font_bold = strstr(font_name, "-Bold") ? 1 : 0;
 				font_italic = strstr(font_name, "-Oblique") ? 1 : 0;
-				if (extract_xml_tag_attributes_find_int(&tag, "wmode", &wmode)) goto end;
+				if (extract_xml_str_to_int(values[3], &wmode)) goto end;
 				if (extract_span_begin(extract,
 									   font_name,
 									   font_bold,
@@ -1062,15 +1394,16 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 						goto end;
 					}
 
-					if (extract_xml_tag_attributes_find_double(&tag, "x", &x)) goto end;
-					if (extract_xml_tag_attributes_find_double(&tag, "y", &y)) goto end;
-					if (extract_xml_tag_attributes_find_double(&tag, "adv", &adv)) goto end;
-					if (extract_xml_tag_attributes_find_uint(&tag, "ucs", &ucs)) goto end;
+					if (s_char_read(&tag, &x, &y, &adv, &ucs)) goto end;
 
 					/* BBox is bogus here. Analysis will fail. */
 					if (extract_add_char(extract, x, y, ucs, adv, x, y, x + adv, y + adv)) goto end;
 				}
 
+				/* This removes the span if extract_add_char() dropped all of
+				its chars, as it can for overprinted or culled chars. */
+				if (extract_span_end(extract)) goto end;
+
 				extract_xml_tag_free(extract->alloc, &tag);
 			}
 		}
@@ -1079,10 +1412,13 @@ int extract_read_intermediate(extract_t *extract, extract_buffer_t *buffer)
 				document->pages_num, content_count_spans(&subpage->content));
 	}
 
-	outf("num_spans=%i num_spans_split=%i num_spans_autosplit=%i",
+	outf("num_spans=%i num_spans_split=%i num_spans_autosplit=%i num_spans_continued=%i num_chars_overprinted=%i num_chars_culled=%i",
 			num_spans,
 			extract->num_spans_split,
-			extract->num_spans_autosplit
+			extract->num_spans_autosplit,
+			extract->num_spans_continued,
+			extract->num_chars_overprinted,
+			extract->num_chars_culled
 			);
 
 	ret = 0;
@@ -1115,8 +1451,8 @@ extract_span_begin(
 	subpage_t      *subpage;
 	span_t         *span;
 	document_t     *document = &extract->document;
-
-	/* FIXME: RJW: Should continue the last span if everything is the same. */
+	content_t      *last;
+	int             font_id;
 
 	assert(document->pages_num > 0);
 	page = document->pages[document->pages_num-1];
@@ -1128,6 +1464,45 @@ extract_span_begin(
 		 ctm_d,
 		 font_name,
 		 wmode);
+
+	{
+		const char *ff = strchr(font_name, '+');
+		const char *f = (ff) ? ff+1 : font_name;
+		if (extract_fonts_intern(extract->alloc, &document->fonts, f, font_bold, font_italic, &font_id)) goto end;
+	}
+
+	/* Callers such as gs start a new span for each show operator, so if
+	everything matches the last span on this subpage we continue it instead of
+	starting a new one; extract_add_char() will still split it if the next
+	char is not where the last one ended. */
+	last = subpage->content.base.prev;
+	if (last->type == content_span)
+	{
+		span = (span_t *) last;
+		if (span->chars_num > 0
+				&& span->structure == document->current
+				&& span->font_id == font_id
+				&& span->flags.font_bold == (font_bold ? 1 : 0)
+				&& span->flags.font_italic == (font_italic ? 1 : 0)
+				&& span->flags.wmode == (wmode ? 1 : 0)
+				&& span->ctm.a == ctm_a
+				&& span->ctm.b == ctm_b
+				&& span->ctm.c == ctm_c
+				&& span->ctm.d == ctm_d
+				&& span->font_bbox.min.x == bbox_x0
+				&& span->font_bbox.min.y == bbox_y0
+				&& span->font_bbox.max.x == bbox_x1
+				&& span->font_bbox.max.y == bbox_y1
+				)
+		{
+			extract->num_spans_continued += 1;
+			extract->span_continued = 1;
+			extract->span_offset_x = 0;
+			extract->span_offset_y = 0;
+			return 0;
+		}
+	}
+
 	if (content_append_new_span(extract->alloc, &subpage->content, &span, document->current)) goto end;
 	span->ctm.a = ctm_a;
 	span->ctm.b = ctm_b;
@@ -1137,17 +1512,15 @@ extract_span_begin(
 	span->font_bbox.min.y = bbox_y0;
 	span->font_bbox.max.x = bbox_x1;
 	span->font_bbox.max.y = bbox_y1;
-
-	{
-		const char *ff = strchr(font_name, '+');
-		const char *f = (ff) ? ff+1 : font_name;
-		if (extract_strdup(extract->alloc, f, &span->font_name)) goto end;
-		span->flags.font_bold = font_bold ? 1 : 0;
-		span->flags.font_italic = font_italic ? 1 : 0;
-		span->flags.wmode = wmode ? 1 : 0;
-		extract->span_offset_x = 0;
-		extract->span_offset_y = 0;
-	}
+	span->font_id = font_id;
+	span->font_name = document->fonts.fonts[font_id].name;
+	span->flags.font_bold = font_bold ? 1 : 0;
+	span->flags.font_italic = font_italic ? 1 : 0;
+	span->flags.wmode = wmode ? 1 : 0;
+	extract_span_geometry_init(span);
+	extract->span_continued = 0;
+	extract->span_offset_x = 0;
+	extract->span_offset_y = 0;
 
 	e = 0;
 end:
@@ -1161,23 +1534,18 @@ split_to_new_span(extract_alloc_t *alloc, content_root_t *content, span_t *span0
 {
 	content_t  save;
 	span_t    *span;
-	char      *name;
-
-	if (extract_strdup(alloc, span0->font_name, &name))
-		return NULL;
 
 	if (content_append_new_span(alloc, content, &span, span0->structure))
-	{
-		extract_free(alloc, &name);
 		return NULL;
-	}
 
+	/* Font name is interned, so can be shared. */
 	save = span->base; /* Avoid overwriting linked list. */
 	*span = *span0;
 	span->base = save;
-	span->font_name = name;
 	span->chars = NULL;
 	span->chars_num = 0;
+	span->bbox_chars_num = -1;
+	span->line_id = 0;
 
 	return span;
 }
@@ -1217,14 +1585,12 @@ find_previous_non_space_char_ish(content_root_t *content, int *char_num, int *in
 point_t
 extract_predicted_end_of_char(char_t *char_, const span_t *span)
 {
-	double adv = char_->adv;
-	point_t dir = { adv * (1 - span->flags.wmode), adv * span->flags.wmode };
+	point_t end;
 
-	dir = extract_matrix4_transform_point(span->ctm, dir);
-	dir.x += char_->x;
-	dir.y += char_->y;
+	end.x = char_->x + span->dir.x * char_->adv;
+	end.y = char_->y + span->dir.y * char_->adv;
 
-	return dir;
+	return end;
 }
 
 point_t
@@ -1234,6 +1600,206 @@ extract_end_of_span(const span_t *span)
 	return extract_predicted_end_of_char(&span->chars[span->chars_num-1], span);
 }
 
+/* Glyphs are treated as overprinting an earlier glyph with the same ucs and
+orientation if their origins are within overprint_distance points in x and
+y, reduced to overprint_adv times the advance for small glyphs. */
+static const double overprint_distance = 1.0;
+static const double overprint_adv = 0.2;
+
+static unsigned glyph_hash(unsigned ucs, int cell_x, int cell_y)
+{
+	unsigned key[3];
+
+	key[0] = ucs;
+	key[1] = (unsigned) cell_x;
+	key[2] = (unsigned) cell_y;
+
+	return extract_hash(extract_hash_START, key, sizeof(key));
+}
+
+/* Returns index of the first slot in extract->glyphs[], starting at <i>, that
+is empty or has the given key. extract->glyphs_max must be non-zero. */
+static int glyphs_find(extract_t *extract, unsigned i, unsigned ucs, int cell_x, int cell_y)
+{
+	unsigned mask = (unsigned) extract->glyphs_max - 1;
+
+	for (;;)
+	{
+		glyph_t *glyph = &extract->glyphs[i & mask];
+
+		if (!glyph->span) return (int) (i & mask);
+		if (glyph->ucs == ucs && glyph->cell_x == cell_x && glyph->cell_y == cell_y) return (int) (i & mask);
+		i += 1;
+	}
+}
+
+/* Returns index of the empty slot where a glyph with the given key should
+go. */
+static int glyphs_find_empty(extract_t *extract, unsigned ucs, int cell_x, int cell_y)
+{
+	unsigned i = glyph_hash(ucs, cell_x, cell_y);
+
+	for (;;)
+	{
+		int slot = glyphs_find(extract, i, ucs, cell_x, cell_y);
+		if (!extract->glyphs[slot].span) return slot;
+		i = (unsigned) slot + 1;
+	}
+}
+
+static int glyphs_grow(extract_t *extract)
+{
+	glyph_t *old = extract->glyphs;
+	int      old_max = extract->glyphs_max;
+	int      max = old_max ? old_max * 2 : 256;
+	int      i;
+
+	if (extract_malloc(extract->alloc, &extract->glyphs, sizeof(*extract->glyphs) * max))
+	{
+		extract->glyphs = old;
+		return -1;
+	}
+	for (i=0; i<max; ++i)
+		extract->glyphs[i].span = NULL;
+	extract->glyphs_max = max;
+	for (i=0; i<old_max; ++i)
+	{
+		if (!old[i].span) continue;
+		extract->glyphs[glyphs_find_empty(extract, old[i].ucs, old[i].cell_x, old[i].cell_y)] = old[i];
+	}
+	extract_free(extract->alloc, &old);
+
+	return 0;
+}
+
+/* Empties extract->glyphs[], keeping its allocation. */
+static void glyphs_clear(extract_t *extract)
+{
+	int i;
+
+	for (i=0; i<extract->glyphs_max; ++i)
+		extract->glyphs[i].span = NULL;
+	extract->glyphs_num = 0;
+	extract->glyphs_overprinted = 0;
+}
+
+/* Sets *cell_x and *cell_y to the hash cell containing (x, y). Returns -1
+if (x, y) is too far away for the cell to fit in an int. */
+static int glyph_cell(double x, double y, int *cell_x, int *cell_y)
+{
+	if (!(fabs(x) < 1e9 && fabs(y) < 1e9)) return -1;
+	*cell_x = (int) floor(x / overprint_distance);
+	*cell_y = (int) floor(y / overprint_distance);
+	return 0;
+}
+
+/* Returns the glyph on the current subpage that a glyph <ucs> at (x, y) with
+advance <adv> in <span> would overprint, or NULL. */
+static glyph_t *glyphs_overprinted(extract_t *extract, span_t *span, unsigned ucs, double x, double y, double adv)
+{
+	double tolerance = fabs(adv) * sqrt(span->scale_squared) * overprint_adv;
+	int    cell_x, cell_y;
+	int    dx, dy;
+
+	if (extract->glyphs_num == 0) return NULL;
+	if (glyph_cell(x, y, &cell_x, &cell_y)) return NULL;
+	if (tolerance > overprint_distance)
+		tolerance = overprint_distance;
+
+	for (dy = -1; dy <= 1; ++dy)
+	{
+		for (dx = -1; dx <= 1; ++dx)
+		{
+			unsigned i = glyph_hash(ucs, cell_x + dx, cell_y + dy);
+			for (;;)
+			{
+				int      slot = glyphs_find(extract, i, ucs, cell_x + dx, cell_y + dy);
+				glyph_t *glyph = &extract->glyphs[slot];
+				char_t  *char_;
+
+				if (!glyph->span) break;
+				char_ = &glyph->span->chars[glyph->char_i];
+				if (glyph->span->flags.wmode == span->flags.wmode
+						&& glyph->span->rotation_class == span->rotation_class
+						&& fabs(char_->x - x) <= tolerance
+						&& fabs(char_->y - y) <= tolerance)
+				{
+					return glyph;
+				}
+				i = (unsigned) slot + 1;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Adds the last char in <span> to extract->glyphs[]. */
+static int glyphs_add(extract_t *extract, span_t *span)
+{
+	char_t  *char_ = extract_span_char_last(span);
+	glyph_t *glyph;
+	int      cell_x, cell_y;
+
+	if (glyph_cell(char_->x, char_->y, &cell_x, &cell_y)) return 0;
+	if ((extract->glyphs_num + 1) * 2 > extract->glyphs_max)
+	{
+		if (glyphs_grow(extract)) return -1;
+	}
+	glyph = &extract->glyphs[glyphs_find_empty(extract, char_->ucs, cell_x, cell_y)];
+	glyph->span = span;
+	glyph->char_i = span->chars_num - 1;
+	glyph->ucs = char_->ucs;
+	glyph->cell_x = cell_x;
+	glyph->cell_y = cell_y;
+	glyph->overprinted = 0;
+	extract->glyphs_num += 1;
+
+	return 0;
+}
+
+/* Called after <char_> has been appended to <span>. If <char_> is the first
+in <span>, sets span->line_id to continue the open line with the same
+orientation if <span> starts where that line ends, using the same test as
+make_lines(), otherwise to a new id. Then makes <span>'s line the open line. */
+static void
+open_line_add_char(extract_t *extract, span_t *span, char_t *char_)
+{
+	open_line_t *open_line;
+
+	if (span->rotation_class < 0)
+		return;
+
+	open_line = &extract->open_lines[span->flags.wmode * extract_span_ROTATION_CLASSES + span->rotation_class];
+	if (span->line_id == 0)
+	{
+		span->line_id = ++extract->line_id_last;
+		if (open_line->line_id)
+		{
+			char_t *first = &span->chars[0];
+			point_t diff;
+			double  colinear, perp, space_guess;
+
+			diff.x = first->x - open_line->end.x;
+			diff.y = first->y - open_line->end.y;
+			colinear = (diff.x * open_line->dir.x + diff.y * open_line->dir.y) / open_line->scale_squared;
+			perp     = (diff.x * open_line->dir.y - diff.y * open_line->dir.x) / open_line->scale_squared;
+			space_guess = (open_line->adv + first->adv)/2 * extract->master_space_guess;
+			if (fabs(perp) <= 3*space_guess/2 && fabs(colinear) <= space_guess * 4)
+				span->line_id = open_line->line_id;
+		}
+	}
+
+	if (char_->adv != 0)
+	{
+		open_line->line_id = span->line_id;
+		open_line->end = extract_predicted_end_of_char(char_, span);
+		open_line->adv = char_->adv;
+		open_line->dir = span->dir;
+		open_line->scale_squared = span->scale_squared;
+	}
+}
+
 int extract_add_char(
 		extract_t    *extract,
 		double        x,
@@ -1252,25 +1818,48 @@ int extract_add_char(
 	span_t         *span    = content_last_span(&subpage->content);
 	span_t         *span0;
 	int             char_num0;
-	double          dist, perp, scale_squared;
-	point_t         dir;
+	double          dist, perp;
+	double          scale_squared = span->scale_squared;
+	point_t         dir = span->dir;
 	int             intervening_space;
+	int             continued;
 
-	if (span->flags.wmode)
+	outf("(%f %f) ucs=% 5i=%c adv=%f", x, y, ucs, (ucs >=32 && ucs< 127) ? ucs : ' ', adv);
+
+	if (extract->cull_invisible)
 	{
-		dir.x = 0;
-		dir.y = 1;
-		scale_squared = span->ctm.c * span->ctm.c + span->ctm.d * span->ctm.d;
+		/* Use the origin if the bbox is empty or bogus. */
+		rect_t bbox;
+		bbox.min.x = (x0 < x1) ? x0 : x;
+		bbox.min.y = (y0 < y1) ? y0 : y;
+		bbox.max.x = (x0 < x1) ? x1 : x;
+		bbox.max.y = (y0 < y1) ? y1 : y;
+		if (!extract_rect_valid(extract_rect_intersect(extract_rect_intersect(bbox, page->mediabox), extract->clip)))
+		{
+			/* Drop this char. If <span> is left empty, extract_span_end()
+			will remove it. */
+			extract->num_chars_culled += 1;
+			return 0;
+		}
 	}
-	else
+
+	if (extract->overprint_dedup && ucs != ' ' && span->rotation_class >= 0)
 	{
-		dir.x = 1;
-		dir.y = 0;
-		scale_squared = span->ctm.a * span->ctm.a + span->ctm.b * span->ctm.b;
+		glyph_t *glyph = glyphs_overprinted(extract, span, ucs, x, y, adv);
+		if (glyph)
+		{
+			/* Drop this glyph; the earlier one is made bold by
+			extract_subpage_end(). If <span> is left empty,
+			extract_span_end() will remove it. */
+			glyph->overprinted = 1;
+			extract->glyphs_overprinted = 1;
+			extract->num_chars_overprinted += 1;
+			return 0;
+		}
 	}
-	dir = extract_matrix4_transform_point(span->ctm, dir);
 
-	outf("(%f %f) ucs=% 5i=%c adv=%f", x, y, ucs, (ucs >=32 && ucs< 127) ? ucs : ' ', adv);
+	continued = extract->span_continued;
+	extract->span_continued = 0;
 
 	/* Is there a previous span to which we should consider attaching this char. */
 	span0 = find_previous_non_space_char_ish(&subpage->content, &char_num0, &intervening_space);
@@ -1309,8 +1898,10 @@ int extract_add_char(
 		outf("%c x=%g y=%g adv=%g dist=%g perp=%g\n", ucs, x, y, adv, dist, perp);
 
 		/* Arbitrary fractions here; ideally we should consult the font bbox, but we don't currently
-		 * have that. */
-		if (fabs(perp) > 3*space_guess/2 || fabs(dist) > space_guess * 4)
+		 * have that. If extract_span_begin() continued the previous span and this char is drawn back
+		 * over the previous char, it is a separate show of the same text, e.g. for fake bold, so it
+		 * must not be merged into the span as if it were the next char. */
+		if (fabs(perp) > 3*space_guess/2 || fabs(dist) > space_guess * 4 || (continued && ucs != ' ' && dist < -adv0/2))
 		{
 			/* Create new span. */
 			if (span->chars_num > 0)
@@ -1354,22 +1945,26 @@ int extract_add_char(
 			char_ = extract_span_append_c(extract->alloc, span, ' ');
 			if (char_ == NULL) goto end;
 
-			char_->x = predicted_end_of_char0.x;
-			char_->y = predicted_end_of_char0.y;
+			extract_char_set(char_, predicted_end_of_char0.x, predicted_end_of_char0.y, 0, extract_rect_empty);
 		}
 	}
 
 	char_ = extract_span_append_c(extract->alloc, span, ucs);
 	if (char_ == NULL) goto end;
 
-	char_->x = x;
-	char_->y = y;
-
-	char_->adv = adv;
-	char_->bbox.min.x = x0;
-	char_->bbox.min.y = y0;
-	char_->bbox.max.x = x1;
-	char_->bbox.max.y = y1;
+	{
+		rect_t bbox;
+		bbox.min.x = x0;
+		bbox.min.y = y0;
+		bbox.max.x = x1;
+		bbox.max.y = y1;
+		extract_char_set(char_, x, y, adv, bbox);
+	}
+	open_line_add_char(extract, span, char_);
+	if (extract->overprint_dedup && ucs != ' ' && span->rotation_class >= 0)
+	{
+		if (glyphs_add(extract, span)) goto end;
+	}
 
 	e = 0;
 end:
@@ -1400,6 +1995,68 @@ int extract_span_end(extract_t *extract)
 }
 
 
+static unsigned image_hash(const char *type, const void *data, size_t data_size)
+{
+	return extract_hash(extract_hash(extract_hash_START, type, strlen(type) + 1), data, data_size);
+}
+
+/* Returns index of slot in extract->images_unique[] that contains an image
+with the given hash, type and data, or of the empty slot where it should go.
+extract->images_unique_max must be non-zero. */
+static int images_unique_find(
+		extract_t  *extract,
+		unsigned    hash,
+		const char *type,
+		const void *data,
+		size_t      data_size)
+{
+	unsigned mask = (unsigned) extract->images_unique_max - 1;
+	unsigned i = hash & mask;
+
+	for (;;)
+	{
+		image_unique_t *entry = &extract->images_unique[i];
+
+		if (!entry->image) return (int) i;
+		if (entry->hash == hash
+				&& entry->image->data_size == data_size
+				&& !strcmp(entry->image->type, type)
+				&& !memcmp(entry->image->data, data, data_size))
+		{
+			return (int) i;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static int images_unique_grow(extract_t *extract)
+{
+	image_unique_t *old = extract->images_unique;
+	int             old_max = extract->images_unique_max;
+	int             max = old_max ? old_max * 2 : 64;
+	int             i;
+
+	if (extract_malloc(extract->alloc, &extract->images_unique, sizeof(*extract->images_unique) * max))
+	{
+		extract->images_unique = old;
+		return -1;
+	}
+	for (i=0; i<max; ++i)
+		extract->images_unique[i].image = NULL;
+	extract->images_unique_max = max;
+	for (i=0; i<old_max; ++i)
+	{
+		image_t *image = old[i].image;
+		int      slot;
+		if (!image) continue;
+		slot = images_unique_find(extract, old[i].hash, image->type, image->data, image->data_size);
+		extract->images_unique[slot] = old[i];
+	}
+	extract_free(extract->alloc, &old);
+
+	return 0;
+}
+
 int extract_add_image(
 		extract_t               *extract,
 		const char              *type,
@@ -1420,8 +2077,22 @@ int extract_add_image(
 	extract_page_t *page    = extract->document.pages[extract->document.pages_num-1];
 	subpage_t      *subpage = page->subpages[page->subpages_num-1];
 	image_t        *image;
+	image_t        *original = NULL;
+	unsigned        hash = 0;
+	int             slot = -1;
+
+	if (data_size)
+	{
+		/* Look for an earlier image with the same type and data. */
+		if ((extract->images_unique_num + 1) * 2 > extract->images_unique_max)
+		{
+			if (images_unique_grow(extract)) return -1;
+		}
+		hash = image_hash(type, data, data_size);
+		slot = images_unique_find(extract, hash, type, data, data_size);
+		original = extract->images_unique[slot].image;
+	}
 
-	extract->image_n += 1;
 	if (content_append_new_image(extract->alloc, &subpage->content, &image)) goto end;
 	image->a = a;
 	image->b = b;
@@ -1436,8 +2107,33 @@ int extract_add_image(
 	image->data_free = data_free;
 	image->data_free_handle = data_free_handle;
 	if (extract_strdup(extract->alloc, type, &image->type)) goto end;
-	if (extract_asprintf(extract->alloc, &image->id, "rId%i", extract->image_n) < 0) goto end;
-	if (extract_asprintf(extract->alloc, &image->name, "image%i.%s", extract->image_n, image->type) < 0) goto end;
+	if (original)
+	{
+		/* Share the earlier image's archive entry and relationship id, and
+		release our copy of the data straight away. */
+		outf("image is duplicate of %s", original->name);
+		if (extract_strdup(extract->alloc, original->id, &image->id)) goto end;
+		if (extract_strdup(extract->alloc, original->name, &image->name)) goto end;
+		if (image->data_free)
+			image->data_free(image->data_free_handle, image->data);
+		image->data = NULL;
+		image->data_size = 0;
+		image->data_free = NULL;
+		image->data_free_handle = NULL;
+		image->duplicate = 1;
+	}
+	else
+	{
+		extract->image_n += 1;
+		if (extract_asprintf(extract->alloc, &image->id, "rId%i", extract->image_n) < 0) goto end;
+		if (extract_asprintf(extract->alloc, &image->name, "image%i.%s", extract->image_n, image->type) < 0) goto end;
+		if (slot >= 0)
+		{
+			extract->images_unique[slot].hash = hash;
+			extract->images_unique[slot].image = image;
+			extract->images_unique_num += 1;
+		}
+	}
 
 	subpage->images_num += 1;
 	outf("subpage->images_num=%i", subpage->images_num);
@@ -1495,42 +2191,21 @@ static double s_max(double a, double b)
 	return (a > b) ? a : b;
 }
 
-int extract_add_path4(
-		extract_t *extract,
-		double     ctm_a,
-		double     ctm_b,
-		double     ctm_c,
-		double     ctm_d,
-		double     ctm_e,
-		double     ctm_f,
-		double     x0,
-		double     y0,
-		double     x1,
-		double     y1,
-		double     x2,
-		double     y2,
-		double     x3,
-		double     y3,
-		double     color)
+/* Looks at a quadrilateral in page coordinates, and if it is an axis-aligned
+thin rectangle, appends it to the subpage's horizontal or vertical table
+lines. */
+static int tablelines_add_quad(extract_t *extract, const point_t *points, double color)
 {
 	extract_page_t *page = extract->document.pages[extract->document.pages_num-1];
 	subpage_t      *subpage = page->subpages[page->subpages_num-1];
-	point_t         points[4] = {
-				transform(x0, y0, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f),
-				transform(x1, y1, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f),
-				transform(x2, y2, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f),
-				transform(x3, y3, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f)
-			};
 	rect_t          rect;
 	int             i;
+	double          y0, y1;
 	double          dx, dy;
 
-	outf("cmt=(%f %f %f %f %f %f) points=[(%f %f) (%f %f) (%f %f) (%f %f)]",
-			ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f,
-			x0, y0, x1, y1, x2, y2, x3, y3
-			);
-	outf("extract_add_path4(): [(%f %f) (%f %f) (%f %f) (%f %f)]",
-			x0, y0, x1, y1, x2, y2, x3, y3);
+	outf("[(%f %f) (%f %f) (%f %f) (%f %f)]",
+			points[0].x, points[0].y, points[1].x, points[1].y,
+			points[2].x, points[2].y, points[3].x, points[3].y);
 	/* Find first step with dx > 0. */
 	for (i=0; i<4; ++i)
 	{
@@ -1568,6 +2243,39 @@ int extract_add_path4(
 	return 0;
 }
 
+int extract_add_path4(
+		extract_t *extract,
+		double     ctm_a,
+		double     ctm_b,
+		double     ctm_c,
+		double     ctm_d,
+		double     ctm_e,
+		double     ctm_f,
+		double     x0,
+		double     y0,
+		double     x1,
+		double     y1,
+		double     x2,
+		double     y2,
+		double     x3,
+		double     y3,
+		double     color)
+{
+	point_t         points[4] = {
+				transform(x0, y0, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f),
+				transform(x1, y1, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f),
+				transform(x2, y2, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f),
+				transform(x3, y3, ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f)
+			};
+
+	outf("cmt=(%f %f %f %f %f %f) points=[(%f %f) (%f %f) (%f %f) (%f %f)]",
+			ctm_a, ctm_b, ctm_c, ctm_d, ctm_e, ctm_f,
+			x0, y0, x1, y1, x2, y2, x3, y3
+			);
+
+	return tablelines_add_quad(extract, points, color);
+}
+
 
 int extract_add_line(
 		extract_t *extract,
@@ -1666,6 +2374,10 @@ static int extract_subpage_begin(extract_t *extract, double x0, double y0, doubl
 
 	if (e == 0)
 	{
+		int i;
+		for (i = 0; i < 2 * extract_span_ROTATION_CLASSES; i++)
+			extract->open_lines[i].line_id = 0;
+		glyphs_clear(extract);
 	}
 
 	return e;
@@ -1684,6 +2396,7 @@ int extract_page_begin(extract_t *extract, double x0, double y0, double x1, doub
 	page->subpages = NULL;
 	page->subpages_num = 0;
 	page->split = NULL;
+	extract->clip = extract_rect_infinite;
 
 	if (extract_realloc2(
 			extract->alloc,
@@ -1760,33 +2473,51 @@ int extract_stroke_begin(
 	return 0;
 }
 
+static point_t fill_transform(extract_t *extract, double x, double y)
+{
+	const matrix_t *ctm = &extract->path.fill.ctm;
+	return transform(x, y, ctm->a, ctm->b, ctm->c, ctm->d, ctm->e, ctm->f);
+}
+
+static int point_eq(point_t a, point_t b)
+{
+	return a.x == b.x && a.y == b.y;
+}
+
+/* Finishes the current fill subpath. Fills are implicitly closed, so a
+subpath with four distinct points (plus an optional explicit return to the
+first point) could be a thin rectangle that defines a line in a table. */
+static int fill_subpath_end(extract_t *extract)
+{
+	int n = extract->path.fill.n;
+
+	extract->path.fill.n = 0;
+	if (n == 5 && point_eq(extract->path.fill.points[4], extract->path.fill.points[0]))
+		n = 4;
+	if (n != 4)
+		return 0;
+
+	return tablelines_add_quad(extract, extract->path.fill.points, extract->path.fill.color);
+}
+
 int extract_moveto(extract_t *extract, double x, double y)
 {
 	if (extract->path_type == path_type_FILL)
 	{
-		if (extract->path.fill.n == -1) return 0;
-		if (extract->path.fill.n != 0)
-		{
-			/* This code is broken, really. Certainly don't give an error here,
-			 * cos it's just confusing noise. Refactor this when I get a chance. */
-			extract->path.fill.n = -1;
-			return 0;
-		}
-		extract->path.fill.points[extract->path.fill.n].x = x;
-		extract->path.fill.points[extract->path.fill.n].y = y;
-		extract->path.fill.n += 1;
+		if (fill_subpath_end(extract)) return -1;
+		extract->path.fill.point0 = fill_transform(extract, x, y);
+		extract->path.fill.points[0] = extract->path.fill.point0;
+		extract->path.fill.n = 1;
 		return 0;
 	}
 	else if (extract->path_type == path_type_STROKE)
 	{
+		/* Each subpath is closed back to its own first point. */
 		extract->path.stroke.point.x = x;
 		extract->path.stroke.point.y = y;
 		extract->path.stroke.point_set = 1;
-		if (!extract->path.stroke.point0_set)
-		{
-			extract->path.stroke.point0 = extract->path.stroke.point;
-			extract->path.stroke.point0_set = 1;
-		}
+		extract->path.stroke.point0 = extract->path.stroke.point;
+		extract->path.stroke.point0_set = 1;
 		return 0;
 	}
 	else
@@ -1800,16 +2531,27 @@ int extract_lineto(extract_t *extract, double x, double y)
 {
 	if (extract->path_type == path_type_FILL)
 	{
-		if (extract->path.fill.n == -1)	return 0;
-		if (extract->path.fill.n == 0 || extract->path.fill.n >= 4)
+		point_t point = fill_transform(extract, x, y);
+
+		if (extract->path.fill.n == -1) return 0;
+		if (extract->path.fill.n == 0)
+		{
+			/* No current point, so treat as start of new subpath. */
+			extract->path.fill.point0 = point;
+			extract->path.fill.points[0] = point;
+			extract->path.fill.n = 1;
+			return 0;
+		}
+		/* Ignore zero-length segments. */
+		if (point_eq(point, extract->path.fill.points[extract->path.fill.n - 1])) return 0;
+		if (extract->path.fill.n == 5)
 		{
-			/* This code is broken, really. Certainly don't give an error here,
-			 * cos it's just confusing noise. Refactor this when I get a chance. */
+			/* Too many points for a rectangle; ignore the rest of this
+			 * subpath. */
 			extract->path.fill.n = -1;
 			return 0;
 		}
-		extract->path.fill.points[extract->path.fill.n].x = x;
-		extract->path.fill.points[extract->path.fill.n].y = y;
+		extract->path.fill.points[extract->path.fill.n] = point;
 		extract->path.fill.n += 1;
 		return 0;
 	}
@@ -1856,31 +2598,11 @@ int extract_closepath(extract_t *extract)
 {
 	if (extract->path_type == path_type_FILL)
 	{
-		if (extract->path.fill.n == 4)
-		{
-			/* We are closing a four-element path, so this could be a thin
-			rectangle that defines a line in a table. */
-			int e;
-			e = extract_add_path4(
-					extract,
-					extract->path.fill.ctm.a,
-					extract->path.fill.ctm.b,
-					extract->path.fill.ctm.c,
-					extract->path.fill.ctm.d,
-					extract->path.fill.ctm.e,
-					extract->path.fill.ctm.f,
-					extract->path.fill.points[0].x,
-					extract->path.fill.points[0].y,
-					extract->path.fill.points[1].x,
-					extract->path.fill.points[1].y,
-					extract->path.fill.points[2].x,
-					extract->path.fill.points[2].y,
-					extract->path.fill.points[3].x,
-					extract->path.fill.points[3].y,
-					extract->path.fill.color);
-			if (e) return e;
-		}
-		extract->path.fill.n = 0;
+		if (fill_subpath_end(extract)) return -1;
+		/* Current point is now the start of the closed subpath, which also
+		starts any following subpath that has no moveto. */
+		extract->path.fill.points[0] = extract->path.fill.point0;
+		extract->path.fill.n = 1;
 		return 0;
 	}
 	else if (extract->path_type == path_type_STROKE)
@@ -1904,7 +2626,6 @@ int extract_closepath(extract_t *extract)
 			{
 				return -1;
 			}
-			return 0;
 		}
 		extract->path.stroke.point = extract->path.stroke.point0;
 		return 0;
@@ -1919,10 +2640,13 @@ int extract_closepath(extract_t *extract)
 
 int extract_fill_end(extract_t *extract)
 {
+	int e;
+
 	assert(extract->path_type == path_type_FILL);
+	e = fill_subpath_end(extract);
 	extract->path_type = path_type_NONE;
 
-	return 0;
+	return e;
 }
 
 
@@ -1936,9 +2660,150 @@ int extract_stroke_end(extract_t *extract)
 
 
 
+/* Orders glyph_t's by span and then by index within the span. */
+static int glyphs_compare(const void *a_, const void *b_)
+{
+	const glyph_t *a = a_;
+	const glyph_t *b = b_;
+
+	if (a->span != b->span) return (a->span < b->span) ? -1 : 1;
+	return a->char_i - b->char_i;
+}
+
+/* Sets <span>'s font to the bold version of its current font. */
+static int span_make_bold(extract_t *extract, span_t *span)
+{
+	fonts_t *fonts = &extract->document.fonts;
+
+	if (span->flags.font_bold) return 0;
+	if (extract_fonts_intern(extract->alloc, fonts, span->font_name, 1, span->flags.font_italic, &span->font_id)) return -1;
+	span->font_name = fonts->fonts[span->font_id].name;
+	span->flags.font_bold = 1;
+
+	return 0;
+}
+
+/* Splits <span> into runs of chars that are and are not marked in
+<overprinted>, inserting the new spans after <span>, and makes the runs of
+marked chars bold. */
+static int span_split_overprinted(extract_t *extract, span_t *span, const char *overprinted)
+{
+	int end = span->chars_num;
+
+	while (end > 0)
+	{
+		int     start = end - 1;
+		char    bold = overprinted[start];
+		span_t *run;
+		content_t save;
+
+		while (start > 0 && overprinted[start-1] == bold)
+			start -= 1;
+		if (start == 0)
+		{
+			if (bold && span_make_bold(extract, span)) return -1;
+			break;
+		}
+
+		/* Move chars[start..end) into a new span after <span>. */
+		if (content_new_span(extract->alloc, &run, span->structure)) return -1;
+		save = run->base;
+		*run = *span;
+		run->base = save;
+		run->chars = NULL;
+		run->chars_num = 0;
+		run->bbox_chars_num = -1;
+		if (extract_malloc(extract->alloc, &run->chars, sizeof(*run->chars) * (end - start)))
+		{
+			extract_span_free(extract->alloc, &run);
+			return -1;
+		}
+		memcpy(run->chars, &span->chars[start], sizeof(*run->chars) * (end - start));
+		run->chars_num = end - start;
+		run->base.prev = &span->base;
+		run->base.next = span->base.next;
+		span->base.next->prev = &run->base;
+		span->base.next = &run->base;
+		span->chars_num = start;
+		span->bbox_chars_num = -1;
+		if (bold && span_make_bold(extract, run)) return -1;
+
+		end = start;
+	}
+
+	return 0;
+}
+
+/* Makes the chars on the current subpage that had overprinting glyphs
+dropped by extract_add_char() bold, splitting spans where necessary. */
+static int glyphs_make_bold(extract_t *extract)
+{
+	int      e = -1;
+	glyph_t *overprinted = NULL;
+	int      overprinted_num = 0;
+	char    *marks = NULL;
+	int      marks_max = 0;
+	int      i, j;
+
+	for (i=0; i<extract->glyphs_max; ++i)
+	{
+		if (extract->glyphs[i].span && extract->glyphs[i].overprinted)
+			overprinted_num += 1;
+	}
+	if (extract_malloc(extract->alloc, &overprinted, sizeof(*overprinted) * overprinted_num)) goto end;
+	overprinted_num = 0;
+	for (i=0; i<extract->glyphs_max; ++i)
+	{
+		if (extract->glyphs[i].span && extract->glyphs[i].overprinted)
+			overprinted[overprinted_num++] = extract->glyphs[i];
+	}
+	qsort(overprinted, (size_t) overprinted_num, sizeof(*overprinted), glyphs_compare);
+
+	for (i=0; i<overprinted_num; i=j)
+	{
+		span_t *span = overprinted[i].span;
+		int     c;
+
+		if (span->chars_num > marks_max)
+		{
+			if (extract_realloc2(extract->alloc, &marks, marks_max, span->chars_num)) goto end;
+			marks_max = span->chars_num;
+		}
+		memset(marks, 0, (size_t) span->chars_num);
+		for (j=i; j<overprinted_num && overprinted[j].span == span; ++j)
+			marks[overprinted[j].char_i] = 1;
+
+		/* Spaces between bold chars are bold too. */
+		for (c=1; c<span->chars_num; ++c)
+		{
+			int c2;
+			if (marks[c] || !marks[c-1] || span->chars[c].ucs != ' ') continue;
+			for (c2=c; c2<span->chars_num && span->chars[c2].ucs == ' '; ++c2) {}
+			if (c2 < span->chars_num && marks[c2])
+			{
+				for (; c<c2; ++c)
+					marks[c] = 1;
+			}
+		}
+
+		if (span_split_overprinted(extract, span, marks)) goto end;
+	}
+
+	e = 0;
+end:
+	extract_free(extract->alloc, &marks);
+	extract_free(extract->alloc, &overprinted);
+	return e;
+}
+
 static int extract_subpage_end(extract_t *extract)
 {
-	(void) extract;
+	if (extract->glyphs_overprinted)
+	{
+		if (glyphs_make_bold(extract)) return -1;
+	}
+	glyphs_clear(extract);
+
 	return 0;
 }
 
@@ -2161,23 +3026,18 @@ paragraph_to_text(
 
 		for (span = content_span_iterator_init(&sit, &line->content); span != NULL; span = content_span_iterator_next(&sit))
 		{
-			int c;
-
-			for (c=0; c<span->chars_num; ++c)
-			{
-				/* We encode each character as utf8. */
-				char_t* char_ = &span->chars[c];
-				unsigned cc = char_->ucs;
-				if (extract_astring_catc_unicode(
-						alloc,
-						text,
-						cc,
-						0 /*xml*/,
-						1 /*ascii_ligatures*/,
-						1 /*ascii_dash*/,
-						1 /*ascii_apostrophe*/
-						)) return -1;
-			}
+			/* We encode each character as utf8. */
+			if (span->chars_num && extract_astring_catl_unicode(
+					alloc,
+					text,
+					&span->chars[0].ucs,
+					sizeof(char_t),
+					span->chars_num,
+					0 /*xml*/,
+					1 /*ascii_ligatures*/,
+					1 /*ascii_dash*/,
+					1 /*ascii_apostrophe*/
+					)) return -1;
 		}
 	}
 	if (extract_astring_catc(alloc, text, '\n')) return -1;
@@ -2222,7 +3082,7 @@ static int extract_write_tables_csv(extract_t *extract)
 	int                p;
 	char              *path = NULL;
 	FILE              *f = NULL;
-	extract_astring_t  text = {NULL, 0};
+	extract_astring_t  text = {NULL, 0, 0};
 
 	if (!extract->tables_csv_format) return 0;
 
@@ -2300,16 +3160,36 @@ int extract_process(
 {
 	int e = -1;
 
-	if (extract_realloc2(
+	if (extract->contentss_num == extract->contentss_max)
+	{
+		if (extract_realloc2(
+				extract->alloc,
+				&extract->contentss,
+				sizeof(*extract->contentss) * extract->contentss_max,
+				sizeof(*extract->contentss) * (extract->contentss_max + 1)
+				)) goto end;
+		extract_astring_init(&extract->contentss[extract->contentss_max]);
+		extract->contentss_max += 1;
+	}
+	extract->contentss_num += 1;
+
+	if (extract_document_join(
 			extract->alloc,
-			&extract->contentss,
-			sizeof(*extract->contentss) * extract->contentss_num,
-			sizeof(*extract->contentss) * (extract->contentss_num + 1)
+			&extract->document,
+			extract->layout_analysis,
+			extract->master_space_guess,
+			extract->profile,
+			&extract->page_limits,
+			&extract->page_stats,
+			&extract->progress
 			)) goto end;
-	extract_astring_init(&extract->contentss[extract->contentss_num]);
-	extract->contentss_num += 1;
+	outf("pages_degraded_spans=%i pages_degraded_tablelines=%i pages_degraded_time=%i",
+			extract->page_stats.pages_degraded_spans,
+			extract->page_stats.pages_degraded_tablelines,
+			extract->page_stats.pages_degraded_time
+			);
 
-	if (extract_document_join(extract->alloc, &extract->document, extract->layout_analysis, extract->master_space_guess)) goto end;
+	if (extract_progress(&extract->progress, extract_progress_CONTENT, 0, 1)) goto end;
 
 	switch (extract->format)
 	{
@@ -2321,7 +3201,7 @@ int extract_process(
 				rotation,
 				images,
 				&extract->contentss[extract->contentss_num - 1],
-				&extract->odt_styles
+				&extract->styles
 				)) goto end;
 		break;
 	case extract_format_DOCX:
@@ -2331,7 +3211,8 @@ int extract_process(
 				spacing,
 				rotation,
 				images,
-				&extract->contentss[extract->contentss_num - 1]
+				&extract->contentss[extract->contentss_num - 1],
+				&extract->styles
 				)) goto end;
 		break;
 	case extract_format_HTML:
@@ -2400,6 +3281,19 @@ end:
 	return e;
 }
 
+/* Reports progress for the <n>th item written by extract_write(). */
+static int write_progress(extract_t *extract, int n)
+{
+	int n_max = extract->contentss_num;
+
+	if (extract->format == extract_format_ODT)
+		n_max = odt_template_items_num + extract->images.images_num;
+	else if (extract->format == extract_format_DOCX)
+		n_max = docx_template_items_num + extract->images.images_num;
+
+	return extract_progress(&extract->progress, extract_progress_WRITE, n, n_max);
+}
+
 int extract_write(extract_t *extract, extract_buffer_t *buffer)
 {
 	int            e = -1;
@@ -2414,13 +3308,14 @@ int extract_write(extract_t *extract, extract_buffer_t *buffer)
 		if (extract_zip_open(buffer, &zip)) goto end;
 		for (i=0; i<odt_template_items_num; ++i) {
 			const odt_template_item_t* item = &odt_template_items[i];
+			if (write_progress(extract, i)) goto end;
 			extract_free(extract->alloc, &text2);
 			outf("i=%i item->name=%s", i, item->name);
 			if (extract_odt_content_item(
 					extract->alloc,
 					extract->contentss,
 					extract->contentss_num,
-					&extract->odt_styles,
+					&extract->styles,
 					&extract->images,
 					item->name,
 					item->text,
@@ -2437,6 +3332,7 @@ int extract_write(extract_t *extract, extract_buffer_t *buffer)
 		outf0("extract->images.images_num=%i", extract->images.images_num);
 		for (i=0; i<extract->images.images_num; ++i) {
 			image_t* image = extract->images.images[i];
+			if (write_progress(extract, odt_template_items_num + i)) goto end;
 			extract_free(extract->alloc, &text2);
 			if (extract_asprintf(extract->alloc, &text2, "Pictures/%s", image->name) < 0) goto end;
 			if (extract_zip_write_file(zip, image->data, image->data_size, text2)) goto end;
@@ -2449,6 +3345,7 @@ int extract_write(extract_t *extract, extract_buffer_t *buffer)
 		if (extract_zip_open(buffer, &zip)) goto end;
 		for (i=0; i<docx_template_items_num; ++i) {
 			const docx_template_item_t* item = &docx_template_items[i];
+			if (write_progress(extract, i)) goto end;
 			extract_free(extract->alloc, &text2);
 			outf("i=%i item->name=%s", i, item->name);
 			if (extract_docx_content_item(
@@ -2471,6 +3368,7 @@ int extract_write(extract_t *extract, extract_buffer_t *buffer)
 		}
 		for (i=0; i<extract->images.images_num; ++i) {
 			image_t* image = extract->images.images[i];
+			if (write_progress(extract, docx_template_items_num + i)) goto end;
 			extract_free(extract->alloc, &text2);
 			if (extract_asprintf(extract->alloc, &text2, "word/media/%s", image->name) < 0) goto end;
 			if (extract_zip_write_file(zip, image->data, image->data_size, text2)) goto end;
@@ -2482,6 +3380,7 @@ int extract_write(extract_t *extract, extract_buffer_t *buffer)
 	case extract_format_TEXT:
 		for (i=0; i<extract->contentss_num; ++i)
 		{
+			if (write_progress(extract, i)) goto end;
 			if (extract_buffer_write(buffer, extract->contentss[i].chars, extract->contentss[i].chars_num, NULL)) goto end;
 		}
 		break;
@@ -2492,6 +3391,7 @@ int extract_write(extract_t *extract, extract_buffer_t *buffer)
 			goto end;
 		for (i=0; i<extract->contentss_num; ++i)
 		{
+			if (write_progress(extract, i)) goto end;
 			if (!first && extract_buffer_cat(buffer, ",\n"))
 				goto end;
 			if (extract->contentss[i].chars_num > 0)
@@ -2560,7 +3460,7 @@ int extract_write_template(
 				extract->alloc,
 				extract->contentss,
 				extract->contentss_num,
-				&extract->odt_styles,
+				&extract->styles,
 				&extract->images,
 				path_template,
 				path_out,
@@ -2580,6 +3480,54 @@ int extract_write_template(
 }
 
 
+int extract_reset(extract_t *extract)
+{
+	document_t *document = &extract->document;
+	int         i;
+
+	/* Free the document's content but keep its font table. */
+	for (i=0; i<document->pages_num; ++i)
+		page_free(extract->alloc, &document->pages[i]);
+	extract_free(extract->alloc, &document->pages);
+	document->pages_num = 0;
+	extract_fonts_clear(extract->alloc, &document->fonts);
+	structure_clear(extract->alloc, document->structure);
+	document->structure = NULL;
+	document->current = NULL;
+
+	/* Empty everything else that is accumulated per-document, keeping the
+	allocated buffers. */
+	for (i=0; i<extract->contentss_num; ++i)
+		extract_astring_clear(&extract->contentss[i]);
+	extract->contentss_num = 0;
+	extract_images_clear(extract->alloc, &extract->images);
+	for (i=0; i<extract->images_unique_max; ++i)
+		extract->images_unique[i].image = NULL;
+	extract->images_unique_num = 0;
+	glyphs_clear(extract);
+	extract_styles_clear(extract->alloc, &extract->styles);
+
+	/* Restore the state set up by extract_begin(). */
+	extract->num_spans_split = 0;
+	extract->num_spans_autosplit = 0;
+	extract->num_spans_continued = 0;
+	extract->span_continued = 0;
+	extract->num_chars_overprinted = 0;
+	extract->num_chars_culled = 0;
+	extract_bzero(&extract->page_stats, sizeof(extract->page_stats));
+	extract->span_offset_x = 0;
+	extract->span_offset_y = 0;
+	extract_bzero(extract->open_lines, sizeof(extract->open_lines));
+	extract->line_id_last = 0;
+	extract->clip = extract_rect_infinite;
+	extract->image_n = 10;
+	extract->tables_csv_i = 0;
+	extract->path_type = path_type_NONE;
+	extract->next_uid = 1;
+
+	return 0;
+}
+
 void extract_end(extract_t **pextract)
 {
 	int i;
@@ -2588,12 +3536,14 @@ void extract_end(extract_t **pextract)
 	if (!extract) return;
 
 	extract_document_free(extract->alloc, &extract->document);
-	for (i=0; i<extract->contentss_num; ++i) {
+	for (i=0; i<extract->contentss_max; ++i) {
 		extract_astring_free(extract->alloc, &extract->contentss[i]);
 	}
 	extract_free(extract->alloc, &extract->contentss);
 	extract_images_free(extract->alloc, &extract->images);
-	extract_odt_styles_free(extract->alloc, &extract->odt_styles);
+	extract_free(extract->alloc, &extract->images_unique);
+	extract_free(extract->alloc, &extract->glyphs);
+	extract_styles_free(extract->alloc, &extract->styles);
 
 	extract_free(extract->alloc, pextract);
 }
@@ -2775,58 +3725,6 @@ double extract_baseline_angle(const matrix4_t *ctm)
 	return atan2(ctm->b, ctm->a);
 }
 
-static rect_t
-extract_span_rect(span_t *span)
-{
-	int	i;
-	rect_t rect = extract_rect_empty;
-
-	for (i = 0; i < span->chars_num; i++)
-		rect = extract_rect_union(rect, span->chars[i].bbox);
-
-	return rect;
-}
-
-static rect_t
-extract_content_rect(content_t *node)
-{
-	content_iterator  it;
-	content_t        *content;
-	content_root_t   *sub = NULL;
-	rect_t            rect = extract_rect_empty;
-
-	if (node == NULL)
-		return rect;
-
-	switch (node->type)
-	{
-	case content_root:
-		break;
-	case content_line:
-		sub = &((line_t *)node)->content;
-		break;
-	case content_paragraph:
-		sub = &((paragraph_t *)node)->content;
-		break;
-	case content_image:
-		break;
-	case content_table:
-		break;
-	case content_block:
-		break;
-	case content_span:
-		rect = extract_span_rect((span_t *)node);
-		break;
-	}
-	if (sub)
-		for (content = content_iterator_init(&it, sub); content != NULL; content = content_iterator_next(&it))
-		{
-			rect = extract_rect_union(rect, extract_content_rect(content));
-		}
-
-	return rect;
-}
-
 static void
 map_classify(
 	content_root_t *root,
@@ -2860,16 +3758,16 @@ map_classify(
 		case content_span:
 		{
 			span_t *span = (span_t *)content;
-			rect_t rect = extract_span_rect(span);
+			rect_t rect = extract_span_bbox(span);
 			rect_t intersect;
-			intersect.min.x = max(rect.min.x, x0);
-			intersect.min.y = max(rect.min.y, y0);
-			intersect.max.x = min(rect.max.x, x1);
-			intersect.max.y = min(rect.max.y, y1);
+			intersect.min.x = s_max(rect.min.x, x0);
+			intersect.min.y = s_max(rect.min.y, y0);
+			intersect.max.x = s_min(rect.max.x, x1);
+			intersect.max.y = s_min(rect.max.y, y1);
 			if (intersect.min.x < intersect.max.x && intersect.min.y < intersect.max.y)
 			{
-				float iarea = (intersect.max.x - intersect.min.x) * (intersect.max.y - intersect.min.y);
-				float area = (rect.max.x - rect.min.x) * (rect.max.y - rect.min.y);
+				double iarea = (intersect.max.x - intersect.min.x) * (intersect.max.y - intersect.min.y);
+				double area = (rect.max.x - rect.min.x) * (rect.max.y - rect.min.y);
 				if (iarea / area > 0.8)
 				{
 					/* At least 80% of the region intersects. */
@@ -2892,7 +3790,6 @@ extract_classify_region(
 		double     x1,
 		double     y1)
 {
-	extract_alloc_t *alloc = extract->alloc;
 	document_t *doc = &extract->document;
 	extract_page_t *page = doc->pages[doc->pages_num-1];
 	int c;
@@ -81,8 +81,6 @@ paragraph_to_html_content(
 
 		for (span = content_span_iterator_init(&sit, &line->content); span != NULL; span = content_span_iterator_next(&sit))
 		{
-			int c;
-
 			content_state->ctm_prev = &span->ctm;
 			if (span->flags.font_bold != content_state->font.bold)
 			{
@@ -99,11 +97,12 @@ paragraph_to_html_content(
 				content_state->font.italic = span->flags.font_italic;
 			}
 
-			for (c=0; c<span->chars_num; ++c)
-			{
-				char_t* char_ = &span->chars[c];
-				if (extract_astring_catc_unicode_xml(alloc, content, char_->ucs)) goto end;
-			}
+			if (span->chars_num && extract_astring_catl_unicode_xml(
+					alloc,
+					content,
+					&span->chars[0].ucs,
+					sizeof(char_t),
+					span->chars_num)) goto end;
 		}
 
 		if (content->chars_num && lit.next->type != content_root)
@@ -69,32 +69,21 @@ static line_t *paragraph_line_last(const paragraph_t *paragraph)
 
 /* Things for direct conversion of text spans into lines and paragraphs. */
 
+/* Returns 1 if spans have the same wmode and their baselines are parallel and
+in the same sense, else 0. We compare the quantised rotation classes rather
+than the matrices themselves, which makes this cheap. Baselines that are
+almost parallel can fall either side of a class boundary, so we also accept
+neighbouring classes; this means that, unlike the sort order in
+paragraphs_key(), this is not transitive. */
 static int
-matrices_are_compatible(const matrix4_t *ctm_a, const matrix4_t *ctm_b, int wmode)
+spans_are_compatible(const span_t *a, const span_t *b)
 {
-	double  dot, pdot;
+	int d;
 
-	/* Calculate the dot product between the direction vector transformed by each ctm. This should be large for
-	 * compatible lines (cos they should be colinear). Also calculate the dot product between the direction
-	 * vector transformed by the first ctm, and perp(direction vector) transformed by the second ctm. This
-	 * should be zero. */
-	if (wmode)
-	{
-		dot  = ctm_a->c * ctm_b->c + ctm_a->d * ctm_b->d;
-		pdot = ctm_a->c * ctm_b->d - ctm_a->d * ctm_b->c;
-	}
-	else
-	{
-		dot  = ctm_a->a * ctm_b->a + ctm_a->b * ctm_b->b;
-		pdot = ctm_a->a * ctm_b->b - ctm_a->b * ctm_b->a;
-	}
-	/* Negative dot means lines are in opposite sense. */
-	if (dot <= 0)
+	if (a->flags.wmode != b->flags.wmode || a->rotation_class < 0 || b->rotation_class < 0)
 		return 0;
-	/* Remove the scaling from pdot to get back to a unit vector. */
-	pdot /= dot;
-
-	return (fabs(pdot) < 0.1);
+	d = (a->rotation_class - b->rotation_class) & (extract_span_ROTATION_CLASSES - 1);
+	return d <= 1 || d == extract_span_ROTATION_CLASSES - 1;
 }
 
 /* Returns 1 if lines have same wmode and have the same baseline vector, else 0. */
@@ -108,11 +97,7 @@ lines_are_compatible(line_t *a,
 	if (a == b) return 0;
 	if (!first_span_a || !first_span_b) return 0;
 
-	/* We only join lines with the same wmode. */
-	if (first_span_a->flags.wmode != first_span_b->flags.wmode)
-		return 0;
-
-	return matrices_are_compatible(&first_span_a->ctm, &first_span_b->ctm, first_span_a->flags.wmode);
+	return spans_are_compatible(first_span_a, first_span_b);
 }
 
 
@@ -123,8 +108,7 @@ rect, and *span modified to remove any char_t's that we have moved to
 <o_span>.
 
 May return with span->chars_num == 0, in which case the caller must remove the
-span (including freeing .font_name), because lots of code assumes that there
-are no empty spans. */
+span, because lots of code assumes that there are no empty spans. */
 static int
 span_inside_rect(
 		extract_alloc_t *alloc,
@@ -137,7 +121,6 @@ span_inside_rect(
 
 	*o_span = *span;
 	*(content_t *)o_span = save; /* Avoid changing prev/next. */
-	extract_strdup(alloc, span->font_name, &o_span->font_name);
 	o_span->chars = NULL;
 	o_span->chars_num = 0;
 	for (c=0; c<span->chars_num; ++c)
@@ -182,19 +165,183 @@ span_inside_rect(
 	return 0;
 }
 
+/* Returns 1 if a line starting with <span_b> is aligned with, and close enough
+to, the end of <span_a> to be appended to a line ending with <span_a>, setting
+*o_colinear, *o_perp and *o_space_guess. Otherwise returns 0. */
+static int
+spans_are_aligned(
+		span_t *span_a,
+		span_t *span_b,
+		double  master_space_guess,
+		double *o_colinear,
+		double *o_perp,
+		double *o_space_guess)
+{
+	char_t *last_a = extract_span_char_last_adv(span_a);
+	point_t tdir = span_a->dir;
+	point_t span_a_end;
+	char_t *first_b;
+	point_t diff;
+	double scale_squared, colinear, perp, space_guess;
+
+	if (last_a == NULL)
+		return 0;
+	/* Predict the end of span_a (after ctm). */
+	span_a_end.x = last_a->x + tdir.x * last_a->adv;
+	span_a_end.y = last_a->y + tdir.y * last_a->adv;
+	/* Find the difference between the end of span_a and the start of span_b (after ctm). */
+	first_b = span_char_first(span_b);
+	diff.x = first_b->x - span_a_end.x;
+	diff.y = first_b->y - span_a_end.y;
+	/* Transforming by by ctm effectively scales diff. We want to undo that scaling, so
+	 * get a value for the scale. */
+	scale_squared = span_a->scale_squared;
+	/* Now find the differences in position, both colinear and perpendicular (pre ctm). */
+	/* diff is post ctm, so is tdir. So the cross products are scaled by scaled_squared. */
+	colinear = (diff.x * tdir.x + diff.y * tdir.y) / scale_squared;
+	perp     = (diff.x * tdir.y - diff.y * tdir.x) / scale_squared;
+	/* colinear and perp are now both pre-transform space distances, to match adv etc. */
+	space_guess = (last_a->adv + first_b->adv)/2 * master_space_guess;
+
+	/* Heuristic: perpendicular distance larger than half of adv rules it out as a match. */
+	/* Ideally we should be using font bbox here, but we don't have that, currently. */
+	/* NOTE: We should match the logic in extract_add_char here! */
+	if (fabs(perp) > 3*space_guess/2 || fabs(colinear) > space_guess * 4)
+		return 0;
+
+	*o_colinear = colinear;
+	*o_perp = perp;
+	*o_space_guess = space_guess;
+	return 1;
+}
+
+/* Moves all the content of <line_b> on to the end of <line_a>, inserting a
+space if <colinear> is large compared to <space_guess>, and frees <line_b>. */
+static int
+line_append(
+		extract_alloc_t *alloc,
+		line_t          *line_a,
+		line_t          *line_b,
+		double           colinear,
+		double           space_guess)
+{
+	span_t *span_a = extract_line_span_last(line_a);
+	span_t *span_b = extract_line_span_first(line_b);
+
+	if (extract_span_char_last(span_a)->ucs != ' ' &&
+		span_char_first(span_b)->ucs != ' ')
+	{
+		/* Again, match the logic in extract_add_char here. */
+		int insert_space = (colinear > 2*space_guess/3);
+		if (insert_space)
+		{
+			/* Append space to span_a before concatenation. */
+			char_t *item = extract_span_append_c(alloc, span_a, ' ');
+			if (item == NULL) return -1;
+			item->adv = 0; /* FIXME */
+			/* This is a hack to give our extra space a vaguely useful
+			(x,y) coordinate - this can be used later on when ordering
+			paragraphs. We could try to be more accurate by adding
+			item[-1]'s .adv suitably transformed by .wmode, .ctm and
+			.trm. */
+			item->x = item[-1].x;
+			item->y = item[-1].y;
+		}
+	}
+
+	/* We might end up with two adjacent spaces here. But removing a
+	space could result in an empty line_t, which could break various
+	assumptions elsewhere. */
+
+	/* Move all the content from line_b to line_a. */
+	content_concat(&line_a->content, &line_b->content);
+	extract_line_free(alloc, &line_b);
+
+	return 0;
+}
+
+/* Appends each line to the earlier line that extract_add_char() found its
+span to continue, as recorded in span_t::line_id, if they are still
+aligned. On entry each line contains a single span. */
+static int
+join_lines_by_id(
+	extract_alloc_t *alloc,
+	content_root_t  *lines,
+	double           master_space_guess)
+{
+	int                    ret = -1;
+	content_line_iterator  lit;
+	line_t                *line;
+	line_t               **open_lines = NULL;
+	int                    id_min = 0;
+	int                    id_max = -1;
+	int                    i;
+
+	for (line = content_line_iterator_init(&lit, lines); line != NULL; line = content_line_iterator_next(&lit))
+	{
+		int id = extract_line_span_first(line)->line_id;
+		if (id <= 0) continue;
+		if (id_max < id_min)
+			id_min = id_max = id;
+		else if (id < id_min)
+			id_min = id;
+		else if (id > id_max)
+			id_max = id;
+	}
+	if (id_max < id_min)
+		return 0;
+
+	if (extract_malloc(alloc, &open_lines, sizeof(*open_lines) * (id_max - id_min + 1))) goto end;
+	for (i = 0; i <= id_max - id_min; i++)
+		open_lines[i] = NULL;
+
+	for (line = content_line_iterator_init(&lit, lines); line != NULL; line = content_line_iterator_next(&lit))
+	{
+		span_t *span = extract_line_span_first(line);
+		line_t *line_a;
+		double  colinear, perp, space_guess;
+
+		if (span->line_id <= 0) continue;
+		line_a = open_lines[span->line_id - id_min];
+		if (!line_a)
+		{
+			open_lines[span->line_id - id_min] = line;
+		}
+		else if (lines_are_compatible(line_a, line)
+				&& spans_are_aligned(extract_line_span_last(line_a), span, master_space_guess, &colinear, &perp, &space_guess)
+				&& fabs(perp) <= space_guess / 4)
+		{
+			if (line_append(alloc, line_a, line, colinear, space_guess)) goto end;
+		}
+		/* Otherwise <line> is left for the nearest-line search in
+		make_lines(). Spans that are offset from the baseline, such as
+		superscripts, end up here, and later spans with the same id are
+		still compared with <line_a> so they can continue it. */
+	}
+
+	ret = 0;
+end:
+	extract_free(alloc, &open_lines);
+	return ret;
+}
+
 /*
 On entry:
 	<lines> is a list of span_t's.
 
 On exit:
 	<lines> is a list of line_t's, made up by having pulled as many of the span_t's
-	as are appropriate together.
+	as are appropriate together. If <fast> is non-zero, only the lines found by
+	extract_add_char() are joined. If <deadline> passes, we stop looking for
+	further joins.
 */
 static int
 make_lines(
 	extract_alloc_t *alloc,
 	content_root_t  *lines,
-	double           master_space_guess)
+	double           master_space_guess,
+	int              fast,
+	deadline_t      *deadline)
 {
 	int                    ret = -1;
 	int                    a;
@@ -213,6 +360,15 @@ make_lines(
 		outfx("initial line a=%i: %s", a, line_string(line));
 	}
 
+	/* Most lines were already found while the chars were added, so join
+	those first; the search below then only has to deal with what is left. */
+	if (join_lines_by_id(alloc, lines, master_space_guess)) goto end;
+	if (fast)
+	{
+		ret = 0;
+		goto end;
+	}
+
 	/* For each line, look for nearest aligned line, and append if found. */
 	for (a=0, line_a = content_line_iterator_init(&lit, lines); line_a != NULL; a++, line_a = content_line_iterator_next(&lit))
 	{
@@ -226,70 +382,39 @@ make_lines(
 		double                 nearest_space_guess = 0;
 		span_t                *span_a;
 
+		if (extract_deadline_passed(deadline))
+		{
+			outf("make_lines(): deadline passed, not joining remaining lines.");
+			break;
+		}
+
 		span_a = extract_line_span_last(line_a);
 
 		for (b = 0, line_b = content_line_iterator_init(&lit2, lines); line_b != NULL; b++, line_b = content_line_iterator_next(&lit2))
 		{
+			double colinear, perp, score, space_guess;
+
 			if (line_a == line_b)
 				continue;
 
 			if (!lines_are_compatible(line_a, line_b))
 				continue;
 
+			if (!spans_are_aligned(span_a, extract_line_span_first(line_b), master_space_guess, &colinear, &perp, &space_guess))
+				continue;
+
+			/* We now form a score for this match. */
+			score = fabs(colinear);
+			if (score < fabs(perp) * 10) /* perpendicular distance matters much more. */
+				score = fabs(perp) * 10;
+
+			if (!nearest_line || score < nearest_score)
 			{
-				span_t *span_b = extract_line_span_first(line_b);
-				char_t *last_a = extract_span_char_last_adv(span_a);
-				point_t dir;
-				point_t tdir;
-				point_t span_a_end;
-				char_t *first_b;
-				point_t diff;
-				double scale_squared, colinear, perp, score, space_guess;
-				static int rjw = 0;
-
-				if (last_a == NULL)
-					continue;
-				/* Predict the end of span_a (after ctm). */
-				dir.x = (1 - span_a->flags.wmode);
-				dir.y = span_a->flags.wmode;
-				tdir = extract_matrix4_transform_point(span_a->ctm, dir);
-				span_a_end.x = last_a->x + tdir.x * last_a->adv;
-				span_a_end.y = last_a->y + tdir.y * last_a->adv;
-				/* Find the difference between the end of span_a and the start of span_b (after ctm). */
-				first_b = span_char_first(span_b);
-				diff.x = first_b->x - span_a_end.x;
-				diff.y = first_b->y - span_a_end.y;
-				/* Transforming by by ctm effectively scales diff. We want to undo that scaling, so
-				 * get a value for the scale. */
-				scale_squared = ((span_a->flags.wmode) ?
-							(span_a->ctm.c * span_a->ctm.c + span_a->ctm.d * span_a->ctm.d) :
-							(span_a->ctm.a * span_a->ctm.a + span_a->ctm.b * span_a->ctm.b));
-				/* Now find the differences in position, both colinear and perpendicular (pre ctm). */
-				/* diff is post ctm, so is tdir. So the cross products are scaled by scaled_squared. */
-				colinear = (diff.x * tdir.x + diff.y * tdir.y) / scale_squared;
-				perp     = (diff.x * tdir.y - diff.y * tdir.x) / scale_squared;
-				/* colinear and perp are now both pre-transform space distances, to match adv etc. */
-				space_guess = (last_a->adv + first_b->adv)/2 * master_space_guess;
-
-				/* Heuristic: perpendicular distance larger than half of adv rules it out as a match. */
-				/* Ideally we should be using font bbox here, but we don't have that, currently. */
-				/* NOTE: We should match the logic in extract_add_char here! */
-				if (fabs(perp) > 3*space_guess/2 || fabs(colinear) > space_guess * 4)
-					 continue;
-
-				/* We now form a score for this match. */
-				score = fabs(colinear);
-				if (score < fabs(perp) * 10) /* perpendicular distance matters much more. */
-					score = fabs(perp) * 10;
-
-				if (!nearest_line || score < nearest_score)
-				{
-					nearest_line = line_b;
-					nearest_score = score;
-					nearest_line_b = b;
-					nearest_colinear = colinear;
-					nearest_space_guess = space_guess;
-				}
+				nearest_line = line_b;
+				nearest_score = score;
+				nearest_line_b = b;
+				nearest_colinear = colinear;
+				nearest_space_guess = space_guess;
 			}
 		}
 
@@ -297,41 +422,12 @@ make_lines(
 		{
 			/* line_a and nearest_line are aligned so we can move line_b's
 			spans on to the end of line_a. */
-			span_t *span_b = extract_line_span_first(nearest_line);
 			b = nearest_line_b;
 
-			if (extract_span_char_last(span_a)->ucs != ' ' &&
-				span_char_first(span_b)->ucs != ' ')
-			{
-				/* Again, match the logic in extract_add_char here. */
-				int insert_space = (nearest_colinear > 2*nearest_space_guess/3);
-				if (insert_space)
-				{
-					/* Append space to span_a before concatenation. */
-					char_t *item = extract_span_append_c(alloc, span_a, ' ');
-					if (item == NULL) goto end;
-					item->adv = 0; /* FIXME */
-					/* This is a hack to give our extra space a vaguely useful
-					(x,y) coordinate - this can be used later on when ordering
-					paragraphs. We could try to be more accurate by adding
-					item[-1]'s .adv suitably transformed by .wmode, .ctm and
-					.trm. */
-					item->x = item[-1].x;
-					item->y = item[-1].y;
-				}
-			}
-
-			/* We might end up with two adjacent spaces here. But removing a
-			space could result in an empty line_t, which could break various
-			assumptions elsewhere. */
-
-			/* Move all the content from nearest_line to line_a. */
-			content_concat(&line_a->content, &nearest_line->content);
-
 			/* Ensure that we ignore nearest_line from now on. */
 			if (lit.next == &nearest_line->base)
 				lit.next = lit.next->next;
-			extract_line_free(alloc, &nearest_line);
+			if (line_append(alloc, line_a, nearest_line, nearest_colinear, nearest_space_guess)) goto end;
 
 			if (b > a) {
 				/* We haven't yet tried appending any spans to nearest_line, so
@@ -356,68 +452,46 @@ end:
 }
 
 
-/* A comparison function, for sorting paragraphs within a
-page. */
-static int paragraphs_cmp(const content_t *a, const content_t *b)
+/* Returns a sort key for a span_t::rotation_class, which orders classes by
+the cosine and then the sine of their angles. This matches how
+extract_matrix4_cmp() orders unscaled rotation matrices. */
+static int rotation_class_order(int rotation_class)
 {
-	const paragraph_t *a_paragraph = (const paragraph_t *)a;
-	const paragraph_t *b_paragraph = (const paragraph_t *)b;
-	line_t *a_line, *b_line;
-	span_t *a_span, *b_span;
-
-	if (a->type != content_paragraph || b->type != content_paragraph)
-		return 0;
+	int n = extract_span_ROTATION_CLASSES;
+	int from_zero = (rotation_class < n - rotation_class) ? rotation_class : n - rotation_class;
 
-	a_line = paragraph_line_first(a_paragraph);
-	b_line = paragraph_line_first(b_paragraph);
-	a_span = extract_line_span_first(a_line);
-	b_span = extract_line_span_first(b_line);
+	return 2 * (n / 2 - from_zero) + (rotation_class < n / 2);
+}
 
-	/* We can't directly compare stuff with different wmodes. */
-	if (a_span->flags.wmode != b_span->flags.wmode)
-	{
-		return a_span->flags.wmode - b_span->flags.wmode;
-	}
+/* Sort key function for sorting paragraphs within a page.
 
-	/* If matrices are compatible (i.e. they share the same baseline vector), don't consider that as
-	 * part of the sort.
-	 *
-	 * Actually, is this safe? We don't necessarily have transitivity here due to the epsilon in the
-	 * comparison. A might be compatible with B, and B with C, but A might not be with C.
-	 * Worry about that if we get an example.
-	 */
-	if (!matrices_are_compatible(&a_span->ctm, &b_span->ctm, a_span->flags.wmode))
-	{
-		/* If ctm matrices differ, always return this diff first. Note that we
-		ignore .e and .f because if data is from ghostscript then .e and .f
-		vary for each span, and we don't care about these differences. */
-		return extract_matrix4_cmp(&a_span->ctm, &b_span->ctm);
-	}
+Paragraphs are ordered by wmode, then by rotation class, so that text with
+parallel baselines is kept together, and then by how far down the page
+(perpendicular to the baseline) the first line starts. */
+static int paragraphs_key(const content_t *content, content_sort_key_t *o_key)
+{
+	span_t  *span;
+	point_t  unit;
+	double   scale;
 
-	/* So, we know the matrices are compatible - i.e. the baselines are parallel.
-	 * Just sort on how far down the page we are going. */
-	{
-		span_t *span_a = content_first_span(&a_line->content);
-		span_t *span_b = content_first_span(&b_line->content);
-		point_t dir  = { 1 - span_a->flags.wmode, span_a->flags.wmode };
-		point_t tdir = extract_matrix4_transform_point(span_a->ctm, dir);
-		point_t diff = { span_a->chars[0].x - span_b->chars[0].x, span_a->chars[0].y - span_b->chars[0].y };
-		double perp     = (diff.x * tdir.y - diff.y * tdir.x);
+	if (content->type != content_paragraph)
+		return 0;
 
-#if 0
-		printf("Comparing:\n");
-		content_dump_brief(&a_line->content);
-		printf("And:\n");
-		content_dump_brief(&b_line->content);
-		printf("perp=%g\n", perp);
-#endif
+	span = extract_line_span_first(paragraph_line_first((const paragraph_t *)content));
 
-		if (perp < 0)
-			return 1;
-		if (perp > 0)
-			return -1;
+	o_key->major = span->flags.wmode * 256 + rotation_class_order(span->rotation_class);
+	o_key->minor = 0;
+	if (span->rotation_class >= 0)
+	{
+		/* Use the unit baseline vector, so that paragraphs with different
+		scales are comparable; this is exact for axis-aligned text. */
+		scale = sqrt(span->scale_squared);
+		unit.x = span->dir.x / scale;
+		unit.y = span->dir.y / scale;
+		o_key->minor = span->chars[0].y * unit.x - span->chars[0].x * unit.y;
 	}
-	return 0;
+
+	return 1;
 }
 
 static double
@@ -452,18 +526,76 @@ calculate_line_height(line_t *line)
 	line->descender = desc;
 }
 
+/* Returns 1 if <line_b> is a candidate to follow <line_a> in a paragraph,
+setting *o_score to the distance down the page from <line_a> to <line_b>.
+Otherwise returns 0. */
+static int
+paragraph_score(line_t *line_a, line_t *line_b, double *o_score)
+{
+	if (!lines_are_compatible(line_a, line_b))
+		return 0;
+
+	{
+		span_t *line_a_first_span = extract_line_span_first(line_a);
+		span_t *line_a_last_span  = extract_line_span_last(line_a);
+		span_t *line_b_first_span = extract_line_span_first(line_b);
+		span_t *line_b_last_span  = extract_line_span_last(line_b);
+		char_t *first_a = span_char_first(line_a_first_span);
+		char_t *first_b = span_char_first(line_b_first_span);
+		char_t *last_a = span_char_last(line_a_last_span);
+		char_t *last_b = span_char_last(line_b_last_span);
+		point_t tdir_a = line_a_last_span->dir;
+		point_t tdir_b = line_b_last_span->dir;
+		/* Find the difference between the start of span_a and the start of span_b. */
+		point_t start_diff = { first_b->x - first_a->x, first_b->y - first_a->y };
+		point_t end_a = { last_a->x + last_a->adv * tdir_a.x, last_a->y + last_a->adv * tdir_a.y };
+		point_t end_b = { last_b->x + last_b->adv * tdir_b.x, last_b->y + last_b->adv * tdir_b.y };
+		/* Now find the perpendicular difference in position. */
+		double scale_squared = line_a_last_span->scale_squared;
+		double perp     = (start_diff.x * tdir_a.y - start_diff.y * tdir_a.x) / sqrt(scale_squared);
+		/* perp is now a post-transform space distance. */
+		double score;
+		/* Now consider the linear difference between: 1) start of a to end of a, 2) start of a to start of b,
+		 * 3) start of a and the end of b. */
+		point_t saea = { end_a.x    - first_a->x, end_a.y    - first_a->y };
+		point_t sasb = { first_b->x - first_a->x, first_b->y - first_a->y };
+		point_t saeb = { end_b.x    - first_a->x, end_b.y    - first_a->y };
+		double dot_saea = ( saea.x * tdir_a.x + saea.y * tdir_a.y );
+		double dot_sasb = ( sasb.x * tdir_a.x + sasb.y * tdir_a.y );
+		double dot_saeb = ( saeb.x * tdir_a.x + saeb.y * tdir_a.y );
+
+		/* We are only interested in scoring down the page. */
+		score = -perp;
+
+		/* Check for "horizontal" alignment of the two lines. If line_b starts
+		 * entirely to the right of the end of line_a, we can't join with it. */
+		if (dot_sasb > dot_saea)
+			return 0;
+		/* If line_b ends entirely to the left of the start of line_a, we can't
+		 * join with it. */
+		if (dot_saeb < 0)
+			return 0;
+
+		*o_score = score;
+		return 1;
+	}
+}
+
 /*
 On entry:
   <content> is a list of lines.
 
 On exit:
   <content> is a list of paragraphs, formed from pulling appropriate lines
-  together.
+  together. If <fast> is non-zero, or once <deadline> has passed, a line is
+  only ever joined to the paragraph before it in <content>.
 */
 static int
 make_paragraphs(
 	extract_alloc_t *alloc,
-	content_root_t  *content)
+	content_root_t  *content,
+	int              fast,
+	deadline_t      *deadline)
 {
 	int                         ret = -1;
 	int                         a;
@@ -491,85 +623,44 @@ make_paragraphs(
 		paragraph_t                *paragraph_b;
 		content_paragraph_iterator  pit2;
 		int b;
-		span_t                     *span_a;
 
 		line_a = paragraph_line_last(paragraph_a);
 		assert(line_a != NULL);
-		span_a = extract_line_span_last(line_a);
-		assert(span_a != NULL);
+
+		if (!fast && extract_deadline_passed(deadline))
+		{
+			outf("make_paragraphs(): deadline passed, only joining adjacent paragraphs.");
+			fast = 1;
+		}
 
 		/* Look for nearest paragraph_t that could be appended to
-		paragraph_a. */
-		for (b=0, paragraph_b = content_paragraph_iterator_init(&pit2, content); paragraph_b != NULL; b++, paragraph_b = content_paragraph_iterator_next(&pit2))
+		paragraph_a. In fast mode, only consider the next paragraph. */
+		if (fast)
 		{
-			line_t *line_b;
+			double score;
+
+			paragraph_b = content_next_paragraph(&paragraph_a->base);
+			if (paragraph_b && paragraph_score(line_a, paragraph_line_first(paragraph_b), &score) && score >= 0)
+			{
+				nearest_paragraph = paragraph_b;
+				nearest_score = score;
+				nearest_paragraph_b = a + 1;
+			}
+		}
+		else for (b=0, paragraph_b = content_paragraph_iterator_init(&pit2, content); paragraph_b != NULL; b++, paragraph_b = content_paragraph_iterator_next(&pit2))
+		{
+			double score;
 
 			if (paragraph_a == paragraph_b)
 				continue;
-			line_b = paragraph_line_first(paragraph_b);
-			if (!lines_are_compatible(line_a, line_b)) {
+			if (!paragraph_score(line_a, paragraph_line_first(paragraph_b), &score))
 				continue;
-			}
 
+			if (score >= 0 && (!nearest_paragraph || score < nearest_score))
 			{
-				span_t *line_a_first_span = extract_line_span_first(line_a);
-				span_t *line_a_last_span  = extract_line_span_last(line_a);
-				span_t *line_b_first_span = extract_line_span_first(line_b);
-				span_t *line_b_last_span  = extract_line_span_last(line_b);
-				char_t *first_a = span_char_first(line_a_first_span);
-				char_t *first_b = span_char_first(line_b_first_span);
-				char_t *last_a = span_char_last(line_a_last_span);
-				char_t *last_b = span_char_last(line_b_last_span);
-				point_t dir = { 1 - span_a->flags.wmode, span_a->flags.wmode };
-				point_t tdir_a = extract_matrix4_transform_point(line_a_last_span->ctm, dir);
-				point_t tdir_b = extract_matrix4_transform_point(line_b_last_span->ctm, dir);
-				/* Find the difference between the start of span_a and the start of span_b. */
-				point_t start_diff = { first_b->x - first_a->x, first_b->y - first_a->y };
-				point_t end_a = { last_a->x + last_a->adv * tdir_a.x, last_a->y + last_a->adv * tdir_a.y };
-				point_t end_b = { last_b->x + last_b->adv * tdir_b.x, last_b->y + last_b->adv * tdir_b.y };
-				/* Now find the perpendicular difference in position. */
-				double scale_squared = ((span_a->flags.wmode) ?
-										(span_a->ctm.c * span_a->ctm.c + span_a->ctm.d * span_a->ctm.d) :
-										(span_a->ctm.a * span_a->ctm.a + span_a->ctm.b * span_a->ctm.b));
-				double perp     = (start_diff.x * tdir_a.y - start_diff.y * tdir_a.x) / sqrt(scale_squared);
-				/* perp is now a post-transform space distance. */
-				double score;
-				/* Now consider the linear difference between: 1) start of a to end of a, 2) start of a to start of b,
-				 * 3) start of a and the end of b. */
-				point_t saea = { end_a.x    - first_a->x, end_a.y    - first_a->y };
-				point_t sasb = { first_b->x - first_a->x, first_b->y - first_a->y };
-				point_t saeb = { end_b.x    - first_a->x, end_b.y    - first_a->y };
-				double dot_saea = ( saea.x * tdir_a.x + saea.y * tdir_a.y );
-				double dot_sasb = ( sasb.x * tdir_a.x + sasb.y * tdir_a.y );
-				double dot_saeb = ( saeb.x * tdir_a.x + saeb.y * tdir_a.y );
-
-				/* We are only interested in scoring down the page. */
-				score = -perp;
-
-#if 0
-				printf("Comparing:\n");
-				content_dump_brief(&paragraph_a->content);
-				printf("And:\n");
-				content_dump_brief(&paragraph_b->content);
-				printf("score=%g\n", score);
-				printf("saea=%g sasb=%g saeb=%g\n", dot_saea, dot_sasb, dot_saeb);
-#endif
-
-				/* Check for "horizontal" alignment of the two lines. If line_b starts
-				 * entirely to the right of the end of line_a, we can't join with it. */
-				if (dot_sasb > dot_saea)
-					continue;
-				/* If line_b ends entirely to the left of the start of line_a, we can't
-				 * join with it. */
-				if (dot_saeb < 0)
-					continue;
-
-				if (score >= 0 && (!nearest_paragraph || score < nearest_score))
-				{
-					nearest_paragraph = paragraph_b;
-					nearest_score = score;
-					nearest_paragraph_b = b;
-				}
+				nearest_paragraph = paragraph_b;
+				nearest_score = score;
+				nearest_paragraph_b = b;
 			}
 		}
 
@@ -621,8 +712,13 @@ make_paragraphs(
 					char_t *c = extract_span_append_c(alloc, extract_line_span_last(line_a), ' ');
 					if (c == NULL) goto end;
 					c_prev = &a_span->chars[ a_span->chars_num-2];
-					c->x = c_prev->x + c_prev->adv * a_span->ctm.a;
-					c->y = c_prev->y + c_prev->adv * a_span->ctm.c;
+					extract_char_set(
+							c,
+							c_prev->x + c_prev->adv * a_span->ctm.a,
+							c_prev->y + c_prev->adv * a_span->ctm.c,
+							0,
+							extract_rect_empty
+							);
 				}
 
 				/* Join the two paragraphs by moving content from nearest_paragraph to paragraph_a. */
@@ -651,9 +747,9 @@ make_paragraphs(
 		}
 	}
 
-	/* Sort paragraphs so they appear in correct order, using paragraphs_cmp().
+	/* Sort paragraphs so they appear in correct order, using paragraphs_key().
 	*/
-	content_sort(content, paragraphs_cmp);
+	if (content_sort(alloc, content, paragraphs_key)) goto end;
 
 	ret = 0;
 
@@ -711,10 +807,8 @@ analyse_paragraphs(content_root_t *content)
 			{
 				char_t    *lc     = &span->chars[0];
 				char_t    *rc     = last_non_space_char(span);
-				point_t    dir    = { rc->adv * (1 - span->flags.wmode), rc->adv * span->flags.wmode };
-				point_t    tdir   = extract_matrix4_transform_point(span->ctm, dir);
 				point_t    left   = { lc->x, lc->y };
-				point_t    right  = { rc->x + tdir.x, rc->y + tdir.y };
+				point_t    right  = extract_predicted_end_of_char(rc, span);
 				double     l, r;
 
 				/* We examine the ctm on the first span, and store its inverse. We then map all
@@ -761,10 +855,9 @@ analyse_paragraphs(content_root_t *content)
 			{
 				char_t    *lc     = &span->chars[0];
 				char_t    *rc     = last_non_space_char(span);
-				point_t    dir    = { 1 - span->flags.wmode, span->flags.wmode };
-				point_t    tdir   = extract_matrix4_transform_point(span->ctm, dir);
+				point_t    tdir   = span->dir;
 				point_t    left   = { lc->x, lc->y };
-				point_t    right  = { rc->x + tdir.x * rc->adv, rc->y + tdir.y * rc->adv };
+				point_t    right  = extract_predicted_end_of_char(rc, span);
 				double     l, r;
 
 				/* If we're not the first line, then calculate the length of the first word on the
@@ -873,13 +966,12 @@ spot_rotated_blocks(
 	content_iterator  cit0 = { 0 }; /* Stop clever-clever compilers warning. */
 	content_t        *content0 = NULL;
 	int               ret = -1;
-	matrix4_t         ctm0;
-	int               wmode, wmode0;
+	span_t           *span0 = NULL;
 	int               ctm0_set = 0;
 
 	for (content = content_iterator_init(&cit, lines); content != NULL; content = content_iterator_next(&cit))
 	{
-		matrix4_t ctm;
+		span_t   *span = NULL;
 		int       ctm_set = 0;
 		int       flush = 0;
 
@@ -888,10 +980,8 @@ spot_rotated_blocks(
 			case content_paragraph:
 			{
 				double rotate;
-				span_t *span = content_first_span(&content_first_line(&((paragraph_t *)content)->content)->content);
-				wmode = span->flags.wmode;
-				ctm = span->ctm;
-				rotate = atan2(ctm.b, ctm.a);
+				span = content_first_span(&content_first_line(&((paragraph_t *)content)->content)->content);
+				rotate = atan2(span->ctm.b, span->ctm.a);
 				/* We are not gathering rotated stuff into blocks. If the rotation returns to zero
 				 * then flush any collection we might have found. Otherwise, remember that we have
 				 * a ctm value set, so we can compare to it. */
@@ -901,7 +991,7 @@ spot_rotated_blocks(
 					ctm_set = 1;
 				/* If the ctm value differs from the first ctm0 we met for the current collection,
 				 * flush the collection. */
-				if (ctm0_set && (wmode != wmode0 || !matrices_are_compatible(&ctm, &ctm0, wmode0)))
+				if (ctm0_set && !spans_are_compatible(span, span0))
 					flush = 1;
 				break;
 			}
@@ -929,9 +1019,8 @@ spot_rotated_blocks(
 		}
 		if (ctm_set && !ctm0_set)
 		{
-			ctm0 = ctm;
+			span0 = span;
 			ctm0_set = 1;
-			wmode0 = wmode;
 			content0 = content;
 			cit0 = cit;
 		}
@@ -1010,18 +1099,42 @@ spans_within_rect(
 	return 0;
 }
 
+/* Marks each paragraph in <content> as left-aligned, for when
+analyse_paragraphs() is not run. Otherwise paragraphs would have no flags set,
+which means fully justified. */
+static void
+paragraphs_set_left_aligned(content_root_t *content)
+{
+	content_paragraph_iterator  pit;
+	paragraph_t                *paragraph;
+
+	for (paragraph = content_paragraph_iterator_init(&pit, content); paragraph != NULL; paragraph = content_paragraph_iterator_next(&pit))
+		paragraph->line_flags = paragraph_not_aligned_right | paragraph_not_centred | paragraph_not_fully_justified;
+}
+
 static int
 join_content(
-	extract_alloc_t *alloc,
-	content_root_t  *lines,
-	double master_space_guess)
+	extract_alloc_t   *alloc,
+	content_root_t    *lines,
+	double             master_space_guess,
+	extract_profile_t  profile,
+	deadline_t        *deadline)
 {
-	if (make_lines(alloc, lines, master_space_guess))
-		return -1;
-	if (make_paragraphs(alloc, lines))
+	/* If <deadline> has already passed, make_lines() and make_paragraphs()
+	notice on their first iteration and do no more than in fast mode. */
+	int fast = (profile == extract_profile_FAST);
+
+	if (make_lines(alloc, lines, master_space_guess, fast, deadline))
 		return -1;
-	if (analyse_paragraphs(lines))
+	if (make_paragraphs(alloc, lines, fast, deadline))
 		return -1;
+	if (profile == extract_profile_FULL && !extract_deadline_passed(deadline))
+	{
+		if (analyse_paragraphs(lines))
+			return -1;
+	}
+	else
+		paragraphs_set_left_aligned(lines);
 	if (spot_rotated_blocks(alloc, lines))
 		return -1;
 
@@ -1217,7 +1330,9 @@ table_find_cells_text(
 		cell_t          **cells,
 		int               cells_num_x,
 		int               cells_num_y,
-		double            master_space_guess)
+		double            master_space_guess,
+		extract_profile_t profile,
+		deadline_t       *deadline)
 {
 	/* Find text within each cell. We don't attempt to handle images within
 	cells. */
@@ -1233,7 +1348,7 @@ table_find_cells_text(
 
 		if (spans_within_rect(alloc, &subpage->content, &cell->rect, &cell->content))
 			return -1;
-		if (join_content(alloc, &cell->content, master_space_guess))
+		if (join_content(alloc, &cell->content, master_space_guess, profile, deadline))
 			return -1;
 	}
 
@@ -1278,9 +1393,16 @@ end:
 
 
 /* Finds single table made from lines whose y coordinates are in the range
-y_min..y_max. */
+y_min..y_max. Does nothing if <deadline> has passed. */
 static int
-table_find(extract_alloc_t *alloc, subpage_t *subpage, double y_min, double y_max, double master_space_guess)
+table_find(
+		extract_alloc_t   *alloc,
+		subpage_t         *subpage,
+		double             y_min,
+		double             y_max,
+		double             master_space_guess,
+		extract_profile_t  profile,
+		deadline_t        *deadline)
 {
 	tablelines_t *all_h = &subpage->tablelines_horizontal;
 	tablelines_t *all_v = &subpage->tablelines_vertical;
@@ -1300,6 +1422,12 @@ table_find(extract_alloc_t *alloc, subpage_t *subpage, double y_min, double y_ma
 
 	outf("y=(%f %f)", y_min, y_max);
 
+	if (extract_deadline_passed(deadline))
+	{
+		outf("table_find(): deadline passed, not looking for table.");
+		return 0;
+	}
+
 	if (table_find_y_range(alloc, all_h, y_min, y_max, &tl_h)) goto end;
 	if (table_find_y_range(alloc, all_v, y_min, y_max, &tl_v)) goto end;
 	/* Suppress false coverity warning - qsort() does not dereference null
@@ -1462,7 +1590,7 @@ table_find(extract_alloc_t *alloc, subpage_t *subpage, double y_min, double y_ma
 
 	if (table_find_extend(cells, cells_num_x, cells_num_y)) goto end;
 
-	if (table_find_cells_text(alloc, subpage, cells, cells_num_x, cells_num_y, master_space_guess)) goto end;
+	if (table_find_cells_text(alloc, subpage, cells, cells_num_x, cells_num_y, master_space_guess, profile, deadline)) goto end;
 
 	e = 0;
 end:
@@ -1488,9 +1616,11 @@ and page->tablelines_vertical that look like table dividers.
 Any text found inside tables is removed from page->spans[].
 */
 static int extract_subpage_tables_find_lines(
-		extract_alloc_t *alloc,
-		subpage_t       *subpage,
-		double           master_space_guess)
+		extract_alloc_t   *alloc,
+		subpage_t         *subpage,
+		double             master_space_guess,
+		extract_profile_t  profile,
+		deadline_t        *deadline)
 {
 	double miny;
 	double maxy;
@@ -1578,7 +1708,7 @@ static int extract_subpage_tables_find_lines(
 			{
 				outf("New table. maxy=%f miny=%f", maxy, miny);
 				/* Find table. */
-				table_find(alloc, subpage, miny - margin, maxy + margin, master_space_guess);
+				table_find(alloc, subpage, miny - margin, maxy + margin, master_space_guess, profile, deadline);
 			}
 			miny = tl->rect.min.y;
 		}
@@ -1586,7 +1716,7 @@ static int extract_subpage_tables_find_lines(
 	}
 
 	/* Find last table. */
-	table_find(alloc, subpage, miny - margin, maxy + margin, master_space_guess);
+	table_find(alloc, subpage, miny - margin, maxy + margin, master_space_guess, profile, deadline);
 
 	return 0;
 }
@@ -1624,11 +1754,13 @@ an image of a page, or looking for blocks of whitespace in between chunks of
 text. */
 static int
 extract_subpage_tables_find(
-		extract_alloc_t *alloc,
-		subpage_t       *subpage,
-		double           master_space_guess)
+		extract_alloc_t   *alloc,
+		subpage_t         *subpage,
+		double             master_space_guess,
+		extract_profile_t  profile,
+		deadline_t        *deadline)
 {
-	if (extract_subpage_tables_find_lines(alloc, subpage, master_space_guess)) return -1;
+	if (extract_subpage_tables_find_lines(alloc, subpage, master_space_guess, profile, deadline)) return -1;
 
 	if (0)
 	{
@@ -1639,49 +1771,138 @@ extract_subpage_tables_find(
 	return 0;
 }
 
-/* Finds tables and paragraphs on <page>. */
+/* Finds tables and paragraphs on <page>. Once <deadline> has passed, the
+remaining work is done as for extract_profile_FAST. <progress> is told about
+each stage, as part of page <p> of <pages_num>. */
 static int
 extract_join_subpage(
-		extract_alloc_t *alloc,
-		subpage_t       *subpage,
-		double           master_space_guess)
+		extract_alloc_t   *alloc,
+		subpage_t         *subpage,
+		double             master_space_guess,
+		extract_profile_t  profile,
+		deadline_t        *deadline,
+		const progress_t  *progress,
+		int                p,
+		int                pages_num)
 {
 	/* Find tables on this page first. This will remove text that is within
 	tables from page->spans, so that text doesn't appear more than once in
 	the final output. */
-	if (extract_subpage_tables_find(alloc, subpage, master_space_guess)) return -1;
+	if (profile != extract_profile_FAST && !extract_deadline_passed(deadline))
+	{
+		if (extract_progress(progress, extract_progress_TABLES, p, pages_num)) return -1;
+		if (extract_subpage_tables_find(alloc, subpage, master_space_guess, profile, deadline)) return -1;
+	}
 
 	/* Now join remaining spans into lines and paragraphs. */
-	if (join_content(alloc, &subpage->content, master_space_guess))
+	if (extract_progress(progress, extract_progress_PARAGRAPHS, p, pages_num)) return -1;
+	if (join_content(alloc, &subpage->content, master_space_guess, profile, deadline))
 		return -1;
 
 	return 0;
 }
 
 
+/* Returns the profile to use for <page>, which is <profile> unless the page
+exceeds one of <limits>, in which case it is extract_profile_FAST and we
+update <stats>. */
+static extract_profile_t
+page_profile(
+		extract_page_t       *page,
+		extract_profile_t     profile,
+		const join_limits_t  *limits,
+		extract_page_stats_t *stats)
+{
+	int spans_num = 0;
+	int tablelines_num = 0;
+	int c;
+
+	for (c=0; c<page->subpages_num; ++c)
+	{
+		subpage_t *subpage = page->subpages[c];
+
+		spans_num += content_count_spans(&subpage->content);
+		tablelines_num += subpage->tablelines_horizontal.tablelines_num;
+		tablelines_num += subpage->tablelines_vertical.tablelines_num;
+	}
+
+	if (limits->max_spans && spans_num > limits->max_spans)
+	{
+		outf("page has %i spans, more than limit %i.", spans_num, limits->max_spans);
+		stats->pages_degraded_spans += 1;
+		profile = extract_profile_FAST;
+	}
+	if (limits->max_tablelines && tablelines_num > limits->max_tablelines)
+	{
+		outf("page has %i tablelines, more than limit %i.", tablelines_num, limits->max_tablelines);
+		stats->pages_degraded_tablelines += 1;
+		profile = extract_profile_FAST;
+	}
+
+	return profile;
+}
+
 /* For each page in <document> we find tables and join spans into lines and paragraphs.
 
 A line is a list of spans that are at the same angle and on the same
 line. A paragraph is a list of lines that are at the same angle and close
 together.
 */
-int extract_document_join(extract_alloc_t *alloc, document_t *document, int layout_analysis, double master_space_guess)
+int extract_document_join(
+		extract_alloc_t      *alloc,
+		document_t           *document,
+		int                   layout_analysis,
+		double                master_space_guess,
+		extract_profile_t     profile,
+		const join_limits_t  *limits,
+		extract_page_stats_t *stats,
+		const progress_t     *progress)
 {
 	int p;
 
 	for (p=0; p<document->pages_num; ++p) {
-		extract_page_t* page = document->pages[p];
-		int c;
+		extract_page_t*    page = document->pages[p];
+		extract_profile_t  profile_page = page_profile(page, profile, limits, stats);
+		deadline_t         deadline = {0, 0};
+		int                c;
+
+		if (limits->max_seconds > 0)
+		{
+			/* Doing the sum in double means a large max_seconds cannot
+			overflow; it just gives a deadline that never passes. */
+			double now = extract_clock();
+			if (now >= 0)
+				deadline.end = now + limits->max_seconds;
+		}
 
 		/* If we have layout analysis enabled, then we do our 'boxer' analysis to
 		 * try to spot subdivisions and subpages. */
-		if (layout_analysis && extract_page_analyse(alloc, page)) return -1;
+		if (layout_analysis && profile_page == extract_profile_FULL)
+		{
+			if (extract_progress(progress, extract_progress_ANALYSE, p, document->pages_num)) return -1;
+			if (extract_page_analyse(alloc, page, &deadline)) return -1;
+		}
 
 		for (c=0; c<page->subpages_num; ++c) {
 			subpage_t* subpage = page->subpages[c];
 
 			outf("processing page %i, subpage %i: num_spans=%i", p, c, content_count_spans(&subpage->content));
-			if (extract_join_subpage(alloc, subpage, master_space_guess)) return -1;
+			if (extract_join_subpage(
+					alloc,
+					subpage,
+					master_space_guess,
+					profile_page,
+					&deadline,
+					progress,
+					p,
+					document->pages_num
+					)) return -1;
+		}
+
+		if (deadline.expired)
+		{
+			outf("page %i: deadline passed, some work was skipped.", p);
+			stats->pages_degraded_time += 1;
 		}
 	}
 
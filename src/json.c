@@ -5,6 +5,7 @@
 #include "astring.h"
 #include "document.h"
 #include "html.h"
+#include "json.h"
 #include "mem.h"
 #include "memento.h"
 #include "outf.h"
@@ -59,6 +60,23 @@ static int output_structure_path(extract_alloc_t *alloc, extract_astring_t *cont
 	return 0;
 }
 
+/* Starts a new element with the given bounds. */
+static int output_bounds(extract_alloc_t *alloc, extract_astring_t *content, const rect_t *bbox)
+{
+	if (extract_astring_cat(alloc, content, "{\n\"Bounds\": [ ") ||
+		extract_astring_catd(alloc, content, bbox->min.x, 6) ||
+		extract_astring_cat(alloc, content, ", ") ||
+		extract_astring_catd(alloc, content, bbox->min.y, 6) ||
+		extract_astring_cat(alloc, content, ", ") ||
+		extract_astring_catd(alloc, content, bbox->max.x, 6) ||
+		extract_astring_cat(alloc, content, ", ") ||
+		extract_astring_catd(alloc, content, bbox->max.y, 6) ||
+		extract_astring_cat(alloc, content, " ]"))
+		return -1;
+
+	return 0;
+}
+
 static int flush(extract_alloc_t *alloc, extract_astring_t *content, span_t *span, structure_t *structure, extract_astring_t *text, rect_t *bbox)
 {
 	if (span == NULL)
@@ -66,9 +84,13 @@ static int flush(extract_alloc_t *alloc, extract_astring_t *content, span_t *spa
 	if (content->chars_num)
 		if (extract_astring_cat(alloc, content, ",\n"))
 			return -1;
-	if (extract_astring_catf(alloc, content, "{\n\"Bounds\": [ %f, %f, %f, %f ],\n\"Text\": \"", bbox->min.x, bbox->min.y, bbox->max.x, bbox->max.y) ||
+	if (output_bounds(alloc, content, bbox) ||
+		extract_astring_cat(alloc, content, ",\n\"Text\": \"") ||
 		extract_astring_catl(alloc, content, text->chars, text->chars_num) ||
-		extract_astring_catf(alloc, content, "\",\n\"Font\": { \"family_name\": \"%s\" },\n\"TextSize\": %g", span->font_name, extract_font_size(&span->ctm)))
+		extract_astring_cat(alloc, content, "\",\n\"Font\": { \"family_name\": \"") ||
+		extract_astring_cat(alloc, content, span->font_name) ||
+		extract_astring_cat(alloc, content, "\" },\n\"TextSize\": ") ||
+		extract_astring_catg(alloc, content, extract_font_size(&span->ctm)))
 		return -1;
 	if (output_structure_path(alloc, content, structure))
 		return -1;
@@ -133,7 +155,7 @@ int extract_document_to_json_content(
 				{
 				case content_span:
 				{
-					int j;
+					int j, k;
 					int do_flush = 0;
 					span_t *span = (span_t *)cont;
 					rect_t span_bbox;
@@ -143,10 +165,8 @@ int extract_document_to_json_content(
 
 					if (last_span &&
 						(structure != span->structure ||
-						 last_span->flags.font_bold != span->flags.font_bold ||
-						 last_span->flags.font_italic != span->flags.font_italic ||
-						 last_span->flags.wmode != span->flags.wmode ||
-						 strcmp(last_span->font_name, span->font_name)))
+						 last_span->font_id != span->font_id ||
+						 last_span->flags.wmode != span->flags.wmode))
 					{
 						do_flush = 1;
 					}
@@ -155,7 +175,7 @@ int extract_document_to_json_content(
 					{
 						if (span->chars[j].ucs == (unsigned int)-1)
 							continue;
-						span_bbox = extract_rect_union(span_bbox, span->chars[j].bbox);
+						span_bbox = extract_rect_union(span_bbox, extract_char_bbox(&span->chars[j]));
 					}
 #if 0 // Enable this to keep lines separate, which aids debugging
 					{
@@ -174,11 +194,12 @@ int extract_document_to_json_content(
 					}
 					last_span = span;
 					structure = span->structure;
-					for (j = 0; j < span->chars_num; j++)
+					/* Append runs of characters, skipping any -1's. */
+					for (j = 0; j < span->chars_num; j = k + 1)
 					{
-						if (span->chars[j].ucs == (unsigned int)-1)
-							continue;
-						if (extract_astring_catc_unicode(alloc, &text, span->chars[j].ucs, 1, 0, 0, 0))
+						for (k = j; k < span->chars_num && span->chars[k].ucs != (unsigned int)-1; k++)
+						{}
+						if (k > j && extract_astring_catl_unicode(alloc, &text, &span->chars[j].ucs, sizeof(char_t), k - j, 1, 0, 0, 0))
 							goto end;
 					}
 					bbox = extract_rect_union(bbox, span_bbox);
@@ -194,8 +215,8 @@ int extract_document_to_json_content(
 					if (content->chars_num)
 						if (extract_astring_cat(alloc, content, ",\n"))
 							return -1;
-					if (extract_astring_catf(alloc, content, "{\n\"Bounds\": [ %f, %f, %f, %f ],\n\"Image\": true",
-									image_bbox.min.x, image_bbox.min.y, image_bbox.max.x, image_bbox.max.y))
+					if (output_bounds(alloc, content, &image_bbox) ||
+						extract_astring_cat(alloc, content, ",\n\"Image\": true"))
 						return -1;
 					if (output_structure_path(alloc, content, structure))
 						return -1;
@@ -55,6 +55,20 @@ int extract_asprintf(extract_alloc_t *alloc, char **out, const char *format, ...
 	return ret;
 }
 
+unsigned extract_hash(unsigned hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	size_t               i;
+
+	for (i=0; i<size; ++i)
+	{
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
 int extract_strdup(extract_alloc_t *alloc, const char *s, char **o_out)
 {
 	size_t l = strlen(s) + 1;
@@ -22,4 +22,11 @@ int extract_asprintf(extract_alloc_t* alloc, char** out, const char* format, ...
 
 int extract_strdup(extract_alloc_t* alloc, const char* s, char** o_out);
 
+/* Initial value for extract_hash(). */
+#define extract_hash_START 2166136261u
+
+/* Returns FNV-1a hash of <size> bytes at <data>, continuing from <hash>,
+which should be extract_hash_START or the result of a previous call. */
+unsigned extract_hash(unsigned hash, const void* data, size_t size);
+
 #endif
@@ -1,8 +1,10 @@
+#include "astring.h"
 #include "memento.h"
 #include "xml.h"
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 
 static int s_num_fails = 0;
@@ -70,6 +72,17 @@ static void s_check_uint(const char* text, unsigned expected_value, int expected
 	s_check(value == expected_value, text, ret, value_s, errno, value_expected_s, expected_errno);
 }
 
+static void s_check_double(const char* text, double expected_value, int expected_errno)
+{
+	double      value;
+	int         ret = extract_xml_str_to_double(text, &value);
+	char        value_s[32];
+	char        value_expected_s[32];
+	snprintf(value_s, sizeof(value_s), "%g", value);
+	snprintf(value_expected_s, sizeof(value_expected_s), "%g", expected_value);
+	s_check(value == expected_value, text, ret, value_s, errno, value_expected_s, expected_errno);
+}
+
 static void s_check_xml_parse(void)
 {
 	int e;
@@ -117,6 +130,193 @@ static void s_check_xml_parse(void)
 	}
 }
 
+typedef struct
+{
+	const char *data;
+	size_t      pos;
+} s_read_state_t;
+
+/* Returns one byte at a time, so that extract_xml_pparse_hex() cannot use a
+cache. */
+static int s_read_one(void *handle, void *destination, size_t numbytes, size_t *o_actual)
+{
+	s_read_state_t *state = handle;
+	*o_actual = 0;
+	if (numbytes && state->data[state->pos]) {
+		*(char *) destination = state->data[state->pos++];
+		*o_actual = 1;
+	}
+	return 0;
+}
+
+static void s_check_xml_hex(void)
+{
+	const char *text =
+			"<image type=\"png\" datasize=\"21\">\n"
+			"000102030405060708090a0b0c0d0e0f\n"
+			"f0 e1 d2 c3 ab\n"
+			"</image>";
+	int         cached;
+
+	for (cached=0; cached<2; ++cached)
+	{
+		extract_buffer_t  *buffer;
+		extract_xml_tag_t  tag;
+		s_read_state_t     state = { NULL, 0 };
+		char               data[21];
+		int                i;
+		int                e;
+
+		printf("testing extract_xml_pparse_hex() cached=%i\n", cached);
+		state.data = text;
+		if (cached)
+			e = extract_buffer_open_simple(NULL /*alloc*/, text, strlen(text), NULL, NULL, &buffer);
+		else
+			e = extract_buffer_open(NULL /*alloc*/, &state, s_read_one, NULL, NULL, NULL, &buffer);
+		s_check_e(e, "extract_buffer_open*()");
+		extract_xml_tag_init(&tag);
+		s_check_e(extract_xml_pparse_init(NULL /*alloc*/, buffer, NULL /*first_line*/), "extract_xml_pparse_init()");
+		s_check_e(extract_xml_pparse_next_tag(buffer, &tag), "extract_xml_pparse_next_tag()");
+		s_check_e(extract_xml_pparse_hex(buffer, data, sizeof(data)), "extract_xml_pparse_hex()");
+		for (i=0; i<16; ++i)
+			s_check_e(data[i] != i, "hex data is correct");
+		s_check_e(memcmp(data + 16, "\xf0\xe1\xd2\xc3\xab", 5), "hex data is correct");
+		s_check_e(extract_xml_pparse_next(buffer, &tag), "extract_xml_pparse_next()");
+		s_check_e(strcmp(tag.name, "/image"), "found </image>");
+		extract_xml_tag_free(NULL /*alloc*/, &tag);
+		extract_buffer_close(&buffer);
+	}
+}
+
+static void s_check_astring_unicode(void)
+{
+	unsigned ucs[0x300 + 12];
+	int      ucs_num = 0;
+	int      flags;
+	unsigned c;
+
+	for (c=0; c<0x300; ++c)
+		ucs[ucs_num++] = c;
+	for (c=0xfb00; c<=0xfb04; ++c)
+		ucs[ucs_num++] = c;
+	ucs[ucs_num++] = 0x2019;
+	ucs[ucs_num++] = 0x2212;
+	ucs[ucs_num++] = 0xfffd;
+	ucs[ucs_num++] = 0x10000;
+	ucs[ucs_num++] = 0x10ffff;
+	ucs[ucs_num++] = 0x110000;
+	ucs[ucs_num++] = (unsigned) -1;
+
+	printf("testing extract_astring_catl_unicode():\n");
+	for (flags=0; flags<16; ++flags)
+	{
+		extract_astring_t expected;
+		extract_astring_t actual;
+		int               i;
+
+		extract_astring_init(&expected);
+		extract_astring_init(&actual);
+		for (i=0; i<ucs_num; ++i)
+		{
+			s_check_e(extract_astring_catc_unicode(NULL, &expected, (int) ucs[i],
+					flags & 1, flags & 2, flags & 4, flags & 8), "extract_astring_catc_unicode()");
+		}
+		/* Append in two parts to check that we append to existing content. */
+		s_check_e(extract_astring_catl_unicode(NULL, &actual, ucs, sizeof(ucs[0]), 100,
+				flags & 1, flags & 2, flags & 4, flags & 8), "extract_astring_catl_unicode()");
+		s_check_e(extract_astring_catl_unicode(NULL, &actual, ucs + 100, sizeof(ucs[0]), ucs_num - 100,
+				flags & 1, flags & 2, flags & 4, flags & 8), "extract_astring_catl_unicode()");
+		s_check_e(actual.chars_num != expected.chars_num
+				|| memcmp(actual.chars, expected.chars, expected.chars_num),
+				"extract_astring_catl_unicode() matches extract_astring_catc_unicode()");
+		extract_astring_free(NULL, &expected);
+		extract_astring_free(NULL, &actual);
+	}
+}
+
+static void s_check_astring_double(void)
+{
+	double values[] = { 0, -0.0, 0.5, 2.5, -1e-9, 1e-4, 9.9999995e-5, 99999.95, 999999.5, 1e20, 12, 595.2755905511812 };
+	int    i;
+
+	printf("testing extract_astring_catd() and extract_astring_catg():\n");
+	for (i=0; i<(int) (sizeof(values) / sizeof(values[0])); ++i)
+	{
+		extract_astring_t actual;
+		char              expected[64];
+		int               precision;
+
+		for (precision=0; precision<=6; precision += 2)
+		{
+			extract_astring_init(&actual);
+			snprintf(expected, sizeof(expected), "%.*f", precision, values[i]);
+			s_check_e(extract_astring_catd(NULL, &actual, values[i], precision), "extract_astring_catd()");
+			s_check_e(strcmp(actual.chars, expected), "extract_astring_catd() matches printf");
+			extract_astring_free(NULL, &actual);
+		}
+		extract_astring_init(&actual);
+		snprintf(expected, sizeof(expected), "%g", values[i]);
+		s_check_e(extract_astring_catg(NULL, &actual, values[i]), "extract_astring_catg()");
+		s_check_e(strcmp(actual.chars, expected), "extract_astring_catg() matches printf");
+		extract_astring_free(NULL, &actual);
+	}
+}
+
+static void *s_realloc(void *state, void *prev, size_t size)
+{
+	(void) state;
+	if (size == 0)
+	{
+		free(prev);
+		return NULL;
+	}
+	return realloc(prev, size);
+}
+
+static void s_check_alloc_pool(void)
+{
+	extract_alloc_t *alloc;
+	char            *blocks[100];
+	char            *block;
+	int              i;
+
+	printf("testing extract_malloc_pooled():\n");
+	s_check_e(extract_alloc_create(s_realloc, NULL, &alloc), "extract_alloc_create()");
+	s_check_e(extract_alloc_pool(alloc, 1), "extract_alloc_pool()");
+	for (i = 0; i < 100; ++i)
+	{
+		s_check_e(extract_malloc_pooled(alloc, &blocks[i], (i % 2) ? 40 : 100), "extract_malloc_pooled()");
+		memset(blocks[i], i, (i % 2) ? 40 : 100);
+	}
+	/* Blocks of the same size are adjacent. */
+	s_check_e(blocks[2] - blocks[0] != 112 || blocks[3] - blocks[1] != 48, "pooled blocks are adjacent");
+	s_check_e(extract_alloc_pool(alloc, 0) != -1 || errno != EBUSY, "extract_alloc_pool() fails with live blocks");
+
+	/* Freed blocks are reused. */
+	block = blocks[10];
+	extract_free_pooled(alloc, &blocks[10], 100);
+	s_check_e(blocks[10] != NULL, "extract_free_pooled() sets pointer to NULL");
+	s_check_e(extract_malloc_pooled(alloc, &blocks[10], 100), "extract_malloc_pooled()");
+	s_check_e(blocks[10] != block, "freed block is reused");
+	for (i = 0; i < 100; ++i)
+	{
+		s_check_e(blocks[i][0] != (char) i && i != 10, "pooled block contents");
+		extract_free_pooled(alloc, &blocks[i], (i % 2) ? 40 : 100);
+	}
+
+	s_check_e(extract_alloc_pool(alloc, 0), "extract_alloc_pool() disable");
+	s_check_e(extract_alloc_pool(NULL, 1) != -1 || errno != EINVAL, "extract_alloc_pool() with NULL alloc");
+
+	/* Pooling cannot be enabled while a block allocated without it is
+	live, because freeing that block would then put it onto a free list. */
+	s_check_e(extract_malloc_pooled(alloc, &block, 100), "extract_malloc_pooled()");
+	s_check_e(extract_alloc_pool(alloc, 1) != -1 || errno != EBUSY, "extract_alloc_pool() fails with unpooled blocks");
+	extract_free_pooled(alloc, &block, 100);
+	s_check_e(extract_alloc_pool(alloc, 1), "extract_alloc_pool() enable after free");
+	s_check_e(extract_alloc_pool(alloc, 0), "extract_alloc_pool() disable");
+	extract_alloc_destroy(&alloc);
+}
+
 
 #if defined(BUILD_MONOLITHIC)
 #define main(v)      extract_test_main(v)
@@ -136,7 +336,22 @@ int main(void)
 	s_check_uint("-20b", 0, EINVAL);
 	s_check_uint("123456789123", 0, ERANGE);
 
+	printf("testing extract_xml_str_to_double():\n");
+	s_check_double("2", 2, 0);
+	s_check_double("-20.125", -20.125, 0);
+	s_check_double("0.1", 0.1, 0);
+	s_check_double("1.5e3", 1500, 0);
+	s_check_double("12345678901234567890.5", 12345678901234567890.5, 0);
+	s_check_double("-20b", 0, EINVAL);
+	s_check_double(".", 0, EINVAL);
+
 	s_check_xml_parse();
+	s_check_xml_hex();
+
+	s_check_astring_unicode();
+	s_check_astring_double();
+
+	s_check_alloc_pool();
 
 	printf("s_num_fails=%i\n", s_num_fails);
 
@@ -15,6 +15,7 @@ odt_paragraph_finish(). */
 #include "mem.h"
 #include "memento.h"
 #include "outf.h"
+#include "styles.h"
 #include "sys.h"
 #include "text.h"
 #include "zip.h"
@@ -49,41 +50,12 @@ odt_paragraph_finish(
 /* ODT doesn't seem to support ad-hoc inline font specifications; instead
 we have to define a style at the start of the content.xml file. So when
 writing content we insert a style name and add the required styles to a
-extract_odt_styles_t struct. */
-
-struct extract_odt_style_t
-{
-	int     id; /* A unique id for this style. */
-	font_t  font;
-};
-
-struct extract_odt_styles_t
-{
-	/* Styles are stored sorted. */
-	extract_odt_style_t *styles;
-	int                  styles_num;
-};
-
-static int
-odt_style_compare(
-		extract_odt_style_t *a,
-		extract_odt_style_t *b)
-{
-	int d;
-	double dd;
-
-	if ((d = strcmp(a->font.name, b->font.name)))   return d;
-	if ((dd = a->font.size - b->font.size) != 0.0)  return (dd > 0.0) ? 1 : -1;
-	if ((d = a->font.bold - b->font.bold))          return d;
-	if ((d = a->font.italic - b->font.italic))      return d;
-
-	return 0;
-}
+extract_styles_t struct. */
 
 static int
 odt_style_append_definition(
 		extract_alloc_t     *alloc,
-		extract_odt_style_t *style,
+		extract_style_t     *style,
 		extract_astring_t   *text)
 {
 	const char* font_name = style->font.name;
@@ -104,34 +76,26 @@ odt_style_append_definition(
 	return 0;
 }
 
-void
-extract_odt_styles_free(
-		extract_alloc_t      *alloc,
-		extract_odt_styles_t *styles)
-{
-	int i;
-
-	for (i=0; i<styles->styles_num; ++i)
-	{
-		extract_odt_style_t* style = &styles->styles[i];
-		extract_free(alloc, &style->font.name);
-	}
-	extract_free(alloc, &styles->styles);
-}
-
 static int
 odt_styles_definitions(
 		extract_alloc_t      *alloc,
-		extract_odt_styles_t *styles,
+		extract_styles_t     *styles,
 		extract_astring_t    *out)
 {
-	int i;
+	int               i;
+	extract_style_t **sorted;
 
 	if (extract_astring_cat(alloc, out, "<office:automatic-styles>")) return -1;
+	if (extract_styles_sorted(alloc, styles, &sorted)) return -1;
 	for (i=0; i<styles->styles_num; ++i)
 	{
-		if (odt_style_append_definition(alloc, &styles->styles[i], out)) return -1;
+		if (odt_style_append_definition(alloc, sorted[i], out))
+		{
+			extract_free(alloc, &sorted);
+			return -1;
+		}
 	}
+	extract_free(alloc, &sorted);
 	extract_astring_cat(alloc, out, "<style:style style:name=\"gr1\" style:family=\"graphic\">\n");
 	extract_astring_cat(alloc, out, "<style:graphic-properties"
 			" draw:stroke=\"none\""
@@ -184,59 +148,18 @@ odt_styles_definitions(
 	return 0;
 }
 
-/* Adds specified style to <styles> if not already present. Sets *o_style to
-point to the style_t within <styles>. */
-static int
-odt_styles_add(
-	extract_alloc_t      *alloc,
-	extract_odt_styles_t *styles,
-	font_t               *font,
-	extract_odt_style_t **o_style)
-{
-	extract_odt_style_t style = {0 /*id*/, *font};
-	int i;
-
-	/* We keep styles->styles[] sorted; todo: use bsearch or similar when
-	searching. */
-	for (i=0; i<styles->styles_num; ++i)
-	{
-		int d = odt_style_compare(&style, &styles->styles[i]);
-		if (d == 0)
-		{
-			*o_style = &styles->styles[i];
-			return 0;
-		}
-		if (d > 0) break;
-	}
-	/* Insert at position <i>. */
-	if (extract_realloc(alloc, &styles->styles, sizeof(styles->styles[0]) * (styles->styles_num+1))) return -1;
-	memmove(&styles->styles[i+1], &styles->styles[i], sizeof(styles->styles[0]) * (styles->styles_num - i));
-	styles->styles_num += 1;
-	styles->styles[i].id = styles->styles_num + 10; /* Leave space for template's built-in styles. */
-	if (extract_strdup(alloc, font->name, &styles->styles[i].font.name)) return -1;
-	styles->styles[i].font.size = font->size;
-	styles->styles[i].font.bold = font->bold;
-	styles->styles[i].font.italic = font->italic;
-	*o_style = &styles->styles[i];
-
-	return 0;
-}
-
 /* Starts a new run. Caller must ensure that s_odt_run_finish() was
 called to terminate any previous run. */
 static int
 extract_odt_run_start(
 		extract_alloc_t      *alloc,
 		extract_astring_t    *content,
-		extract_odt_styles_t *styles,
+		extract_styles_t     *styles,
 		content_state_t      *content_state)
 {
-	extract_odt_style_t* style;
+	extract_style_t *style;
 
-	if (odt_styles_add(alloc,
-					   styles,
-					   &content_state->font,
-					   &style)) return -1;
+	if (extract_styles_add(alloc, styles, &content_state->font, &style)) return -1;
 	if (extract_astring_catf(alloc, content, "<text:span text:style-name=\"T%i\">", style->id)) return -1;
 
 	return 0;
@@ -258,7 +181,7 @@ static int
 odt_append_empty_paragraph(
 		extract_alloc_t      *alloc,
 		extract_astring_t    *content,
-		extract_odt_styles_t *styles)
+		extract_styles_t     *styles)
 {
 	int e = -1;
 	static char fontname[] = "OpenSans";
@@ -292,7 +215,7 @@ document_to_odt_content_paragraph(
 		content_state_t      *content_state,
 		paragraph_t          *paragraph,
 		extract_astring_t    *content,
-		extract_odt_styles_t *styles)
+		extract_styles_t     *styles)
 {
 	int e = -1;
 	content_line_iterator  lit;
@@ -326,15 +249,13 @@ document_to_odt_content_paragraph(
 
 		for (span = content_span_iterator_init(&sit, &line->content); span != NULL; span = content_span_iterator_next(&sit))
 		{
-			int si;
 			double font_size_new;
 
 			content_state->ctm_prev = &span->ctm;
 			font_size_new = extract_font_size(&span->ctm);
+			/* font_id covers font name, bold and italic. */
 			if (!content_state->font.name
-					|| strcmp(span->font_name, content_state->font.name)
-					|| span->flags.font_bold != content_state->font.bold
-					|| span->flags.font_italic != content_state->font.italic
+					|| span->font_id != content_state->font_id
 					|| font_size_new != content_state->font.size
 					)
 			{
@@ -343,18 +264,19 @@ document_to_odt_content_paragraph(
 					if (odt_run_finish(alloc, content_state, content)) goto end;
 				}
 				content_state->font.name = span->font_name;
+				content_state->font_id = span->font_id;
 				content_state->font.bold = span->flags.font_bold;
 				content_state->font.italic = span->flags.font_italic;
 				content_state->font.size = font_size_new;
 				if (extract_odt_run_start( alloc, content, styles, content_state)) goto end;
 			}
 
-			for (si=0; si<span->chars_num; ++si)
-			{
-				char_t* char_ = &span->chars[si];
-				int c = char_->ucs;
-				if (extract_astring_catc_unicode_xml(alloc, content, c)) goto end;
-			}
+			if (span->chars_num && extract_astring_catl_unicode_xml(
+					alloc,
+					content,
+					&span->chars[0].ucs,
+					sizeof(char_t),
+					span->chars_num)) goto end;
 			/* Remove any trailing '-' at end of line. */
 			if (extract_astring_char_truncate_if(content, '-')) goto end;
 		}
@@ -410,7 +332,7 @@ odt_output_rotated_paragraphs(
 		double                h_pt,
 		int                   text_box_id,
 		extract_astring_t    *content,
-		extract_odt_styles_t *styles,
+		extract_styles_t     *styles,
 		content_state_t      *content_state)
 {
 	int                          e = 0;
@@ -465,7 +387,7 @@ odt_append_table(
 		extract_alloc_t      *alloc,
 		table_t              *table,
 		extract_astring_t    *output,
-		extract_odt_styles_t *styles)
+		extract_styles_t     *styles)
 {
 	int e = -1;
 	int y;
@@ -554,7 +476,7 @@ odt_append_rotated_paragraphs(
 		const matrix4_t       *ctm,
 		double                 rotate,
 		extract_astring_t     *output,
-		extract_odt_styles_t  *styles)
+		extract_styles_t      *styles)
 {
 	/* Find extent of paragraphs with this same rotation. extent
 	will contain max width and max height of paragraphs, in units
@@ -667,7 +589,7 @@ extract_page_to_odt_content(
 		int                   rotation,
 		int                   images,
 		extract_astring_t    *output,
-		extract_odt_styles_t *styles)
+		extract_styles_t     *styles)
 {
 	int ret = -1;
 	int text_box_id = 0;
@@ -790,7 +712,7 @@ extract_document_to_odt_content(
 		int                   rotation,
 		int                   images,
 		extract_astring_t    *content,
-		extract_odt_styles_t *styles)
+		extract_styles_t     *styles)
 {
 	int p;
 	int ret = 0;
@@ -819,7 +741,7 @@ extract_odt_content_item(
 		extract_alloc_t      *alloc,
 		extract_astring_t    *contentss,
 		int                   contentss_num,
-		extract_odt_styles_t *styles,
+		extract_styles_t     *styles,
 		images_t             *images,
 		const char           *name,
 		const char           *text,
@@ -885,8 +807,8 @@ extract_odt_content_item(
 	else if (!strcmp(name, "META-INF/manifest.xml"))
 	{
 		/* Add images. */
-        e = 0;
 		int i;
+		e = 0;
 		for (i=0; i<images->images_num; ++i)
 		{
 			image_t* image = images->images[i];
@@ -932,7 +854,7 @@ extract_odt_write_template(
 		extract_alloc_t      *alloc,
 		extract_astring_t    *contentss,
 		int                   contentss_num,
-		extract_odt_styles_t *styles,
+		extract_styles_t     *styles,
 		images_t             *images,
 		const char           *path_template,
 		const char           *path_out,
@@ -5,15 +5,7 @@
 
 /* Things for creating odt files. */
 
-typedef struct extract_odt_style_t extract_odt_style_t;
-
-typedef struct
-{
-    extract_odt_style_t*    styles;
-    int                     styles_num;
-} extract_odt_styles_t;
-
-void extract_odt_styles_free(extract_alloc_t* alloc, extract_odt_styles_t* styles);
+#include "styles.h"
 
 int extract_document_to_odt_content(
         extract_alloc_t*    alloc,
@@ -22,7 +14,7 @@ int extract_document_to_odt_content(
         int                 rotation,
         int                 images,
         extract_astring_t*  o_content,
-        extract_odt_styles_t* o_styles
+        extract_styles_t*   o_styles
         );
 /* Makes *o_content point to a string containing all paragraphs in *document in
 odt XML format.
@@ -37,7 +29,7 @@ int extract_odt_write_template(
         extract_alloc_t*    alloc,
         extract_astring_t*  contentss,
         int                 contentss_num,
-        extract_odt_styles_t* styles,
+        extract_styles_t*   styles,
         images_t*           images,
         const char*         path_template,
         const char*         path_out,
@@ -70,7 +62,7 @@ int extract_odt_content_item(
         extract_alloc_t*    alloc,
         extract_astring_t*  contentss,
         int                 contentss_num,
-        extract_odt_styles_t* styles,
+        extract_styles_t*   styles,
         images_t*           images,
         const char*         name,
         const char*         text,
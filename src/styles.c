@@ -0,0 +1,181 @@
+#include "extract/alloc.h"
+
+#include "mem.h"
+#include "styles.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+void extract_styles_init(extract_styles_t *styles)
+{
+	styles->styles = NULL;
+	styles->styles_num = 0;
+	styles->styles_max = 0;
+	styles->hash = NULL;
+	styles->hash_num = 0;
+}
+
+void extract_styles_clear(extract_alloc_t *alloc, extract_styles_t *styles)
+{
+	int i;
+
+	for (i=0; i<styles->styles_num; ++i)
+	{
+		extract_style_t *style = &styles->styles[i];
+		extract_free(alloc, &style->font.name);
+		extract_free(alloc, &style->run_start);
+	}
+	styles->styles_num = 0;
+	for (i=0; i<styles->hash_num; ++i)
+		styles->hash[i] = -1;
+}
+
+void extract_styles_free(extract_alloc_t *alloc, extract_styles_t *styles)
+{
+	extract_styles_clear(alloc, styles);
+	extract_free(alloc, &styles->styles);
+	extract_free(alloc, &styles->hash);
+	extract_styles_init(styles);
+}
+
+static unsigned
+styles_hash(const font_t *font)
+{
+	unsigned char flags = (unsigned char) ((font->bold ? 1 : 0) | (font->italic ? 2 : 0));
+	unsigned      hash = extract_hash_START;
+
+	hash = extract_hash(hash, font->name, strlen(font->name));
+	hash = extract_hash(hash, &font->size, sizeof(font->size));
+	hash = extract_hash(hash, &flags, 1);
+
+	return hash;
+}
+
+static int
+styles_font_equal(const font_t *a, const font_t *b)
+{
+	return a->size == b->size
+			&& a->bold == b->bold
+			&& a->italic == b->italic
+			&& !strcmp(a->name, b->name);
+}
+
+/* Returns index of hash slot that contains the style for <font>, or of the
+empty slot where it should go. styles->hash_num must be non-zero. */
+static int
+styles_hash_find(extract_styles_t *styles, const font_t *font)
+{
+	unsigned mask = (unsigned) styles->hash_num - 1;
+	unsigned i = styles_hash(font) & mask;
+
+	for (;;)
+	{
+		int id = styles->hash[i];
+
+		if (id < 0) return (int) i;
+		if (styles_font_equal(&styles->styles[id].font, font)) return (int) i;
+		i = (i + 1) & mask;
+	}
+}
+
+static int
+styles_rehash(extract_alloc_t *alloc, extract_styles_t *styles, int hash_num)
+{
+	int i;
+
+	extract_free(alloc, &styles->hash);
+	if (extract_malloc(alloc, &styles->hash, sizeof(*styles->hash) * hash_num))
+	{
+		styles->hash_num = 0;
+		return -1;
+	}
+	styles->hash_num = hash_num;
+	for (i=0; i<hash_num; ++i)
+		styles->hash[i] = -1;
+	for (i=0; i<styles->styles_num; ++i)
+		styles->hash[styles_hash_find(styles, &styles->styles[i].font)] = i;
+
+	return 0;
+}
+
+int extract_styles_add(
+		extract_alloc_t   *alloc,
+		extract_styles_t  *styles,
+		const font_t      *font,
+		extract_style_t  **o_style)
+{
+	extract_style_t *style;
+	int              slot;
+
+	/* Keep load factor at most 1/2. */
+	if ((styles->styles_num + 1) * 2 > styles->hash_num)
+	{
+		if (styles_rehash(alloc, styles, styles->hash_num ? styles->hash_num * 2 : 64)) return -1;
+	}
+
+	slot = styles_hash_find(styles, font);
+	if (styles->hash[slot] >= 0)
+	{
+		*o_style = &styles->styles[styles->hash[slot]];
+		return 0;
+	}
+
+	if (styles->styles_num == styles->styles_max)
+	{
+		int styles_max = styles->styles_max ? styles->styles_max * 2 : 32;
+		if (extract_realloc2(
+				alloc,
+				&styles->styles,
+				sizeof(*styles->styles) * styles->styles_max,
+				sizeof(*styles->styles) * styles_max
+				)) return -1;
+		styles->styles_max = styles_max;
+	}
+	style = &styles->styles[styles->styles_num];
+	if (extract_strdup(alloc, font->name, &style->font.name)) return -1;
+	style->font.size = font->size;
+	style->font.bold = font->bold;
+	style->font.italic = font->italic;
+	style->run_start = NULL;
+	/* Leave space for template's built-in styles. */
+	style->id = styles->styles_num + 11;
+	styles->hash[slot] = styles->styles_num;
+	styles->styles_num += 1;
+	*o_style = style;
+
+	return 0;
+}
+
+/* Orders styles by descending font name, size, bold and italic. */
+static int
+styles_compare(const void *a_, const void *b_)
+{
+	const extract_style_t *a = *(extract_style_t * const *) b_;
+	const extract_style_t *b = *(extract_style_t * const *) a_;
+	int                    d;
+
+	if ((d = strcmp(a->font.name, b->font.name)))   return d;
+	if (a->font.size != b->font.size)               return (a->font.size > b->font.size) ? 1 : -1;
+	if ((d = a->font.bold - b->font.bold))          return d;
+	if ((d = a->font.italic - b->font.italic))      return d;
+
+	return 0;
+}
+
+int extract_styles_sorted(
+		extract_alloc_t    *alloc,
+		extract_styles_t   *styles,
+		extract_style_t  ***o_sorted)
+{
+	int i;
+
+	*o_sorted = NULL;
+	if (styles->styles_num == 0) return 0;
+	if (extract_malloc(alloc, o_sorted, sizeof(**o_sorted) * styles->styles_num)) return -1;
+	for (i=0; i<styles->styles_num; ++i)
+		(*o_sorted)[i] = &styles->styles[i];
+	qsort(*o_sorted, styles->styles_num, sizeof(**o_sorted), styles_compare);
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef ARTIFEX_EXTRACT_STYLES_H
+#define ARTIFEX_EXTRACT_STYLES_H
+
+/* Only for internal use by extract code.  */
+
+/* Registry of text styles used by the odt and docx writers. */
+
+#include "document.h"
+
+
+typedef struct
+{
+	/* A unique id for this style; never changes once the style has been
+	added. */
+	int     id;
+	font_t  font;
+
+	/* Markup for starting a run in this style, created on demand by
+	writers that use inline run properties. NULL if not yet created. */
+	char   *run_start;
+} extract_style_t;
+
+typedef struct
+{
+	/* Styles in the order in which they were added. */
+	extract_style_t  *styles;
+	int               styles_num;
+	int               styles_max;
+
+	/* Open-addressed hash of indices into styles[], -1 for empty slots;
+	hash_num is zero or a power of two. */
+	int              *hash;
+	int               hash_num;
+} extract_styles_t;
+
+void extract_styles_init(extract_styles_t *styles);
+
+void extract_styles_free(extract_alloc_t *alloc, extract_styles_t *styles);
+
+/* Removes all styles, keeping the allocated arrays. */
+void extract_styles_clear(extract_alloc_t *alloc, extract_styles_t *styles);
+
+/* Sets *o_style to point to the style in <styles> that matches <font>'s
+name, size, bold and italic, adding a new style if there is no match. The
+returned pointer is only valid until the next call. */
+int extract_styles_add(
+		extract_alloc_t   *alloc,
+		extract_styles_t  *styles,
+		const font_t      *font,
+		extract_style_t  **o_style);
+
+/* Sets *o_sorted to point to a newly allocated array of pointers to all
+styles, sorted by descending font name, size, bold and italic. Caller must
+free with extract_free(). */
+int extract_styles_sorted(
+		extract_alloc_t    *alloc,
+		extract_styles_t   *styles,
+		extract_style_t  ***o_sorted);
+
+#endif
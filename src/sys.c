@@ -4,6 +4,7 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include <sys/stat.h>
 
@@ -136,3 +137,27 @@ int extract_mkdir(const char *path, int mode)
 	return mkdir(path, mode);
 }
 #endif
+
+#ifdef _WIN32
+#include <windows.h>
+double extract_clock(void)
+{
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (!QueryPerformanceFrequency(&frequency) || !QueryPerformanceCounter(&counter))
+		return (double) GetTickCount64() / 1000;
+	return (double) counter.QuadPart / (double) frequency.QuadPart;
+}
+#elif defined(CLOCK_MONOTONIC)
+double extract_clock(void)
+{
+	struct timespec t;
+	if (clock_gettime(CLOCK_MONOTONIC, &t)) return -1;
+	return (double) t.tv_sec + (double) t.tv_nsec / 1e9;
+}
+#else
+double extract_clock(void)
+{
+	return -1;
+}
+#endif
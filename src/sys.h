@@ -32,4 +32,9 @@ to be relied on. */
 int extract_mkdir(const char* path, int mode);
 /* Compatibility wrapper to cope on Windows. */
 
+double extract_clock(void);
+/* Returns seconds from a monotonic wall clock with an arbitrary origin, or -1
+if no such clock is available. Unlike clock(), this keeps counting while we are
+blocked or descheduled. */
+
 #endif
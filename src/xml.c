@@ -14,6 +14,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
 
 /* These str_*() functions realloc buffer as required. All return 0 or -1 with
 errno set. */
@@ -125,10 +129,28 @@ int extract_xml_tag_attributes_find_size(
 	return extract_xml_str_to_size(text, o_out);
 }
 
+/* Sets *o_out and returns 1 if <text> consists only of 1-18 decimal digits,
+so cannot overflow. Otherwise returns 0. */
+static int s_str_to_digits(const char *text, unsigned long long *o_out)
+{
+	unsigned long long  x = 0;
+	int                 i;
+
+	for (i=0; text[i] >= '0' && text[i] <= '9'; ++i)
+	{
+		x = x * 10 + (unsigned) (text[i] - '0');
+	}
+	if (i == 0 || i > 18 || text[i]) return 0;
+	*o_out = x;
+
+	return 1;
+}
+
 int extract_xml_str_to_llint(const char *text, long long*o_out)
 {
-	char      *endptr;
-	long long  x;
+	char               *endptr;
+	long long           x;
+	unsigned long long  digits;
 
 	if (!text) {
 		errno = ESRCH;
@@ -138,6 +160,11 @@ int extract_xml_str_to_llint(const char *text, long long*o_out)
 		errno = EINVAL;
 		return -1;
 	}
+	/* Fast path for plain integers. */
+	if (s_str_to_digits(text + (text[0] == '-'), &digits)) {
+		*o_out = (text[0] == '-') ? -(long long) digits : (long long) digits;
+		return 0;
+	}
 	errno = 0;
 	x = strtoll(text, &endptr, 10 /*base*/);
 	if (errno) {
@@ -165,6 +192,8 @@ int extract_xml_str_to_ullint(const char *text, unsigned long long *o_out)
 		errno = EINVAL;
 		return -1;
 	}
+	/* Fast path for plain integers. */
+	if (s_str_to_digits(text, o_out)) return 0;
 	errno = 0;
 	x = strtoull(text, &endptr, 10 /*base*/);
 	if (errno) {
@@ -221,6 +250,57 @@ int extract_xml_str_to_size(const char *text, size_t *o_out)
 	return 0;
 }
 
+/* Powers of ten that are exactly representable as doubles. */
+static const double s_pow10[] =
+{
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+double extract_xml_strtod(const char *text, char **endptr)
+{
+	const char         *s = text;
+	unsigned long long  mantissa = 0;
+	int                 digits = 0;
+	int                 decimals = 0;
+	int                 negative = 0;
+	double              x;
+
+	if (*s == '-' || *s == '+')
+	{
+		negative = (*s == '-');
+		s += 1;
+	}
+	for (; *s >= '0' && *s <= '9'; ++s, ++digits)
+	{
+		if (digits < 19) mantissa = mantissa * 10 + (unsigned) (*s - '0');
+	}
+	if (*s == '.')
+	{
+		for (s += 1; *s >= '0' && *s <= '9'; ++s, ++digits, ++decimals)
+		{
+			if (digits < 19) mantissa = mantissa * 10 + (unsigned) (*s - '0');
+		}
+	}
+
+	/* If both mantissa and power of ten are exactly representable, a
+	single division gives the correctly rounded result. Otherwise, e.g.
+	for exponents, hex, inf or nan, we use strtod(). */
+	if (digits == 0
+			|| digits > 19
+			|| mantissa > (1ull << 53)
+			|| decimals >= (int) (sizeof(s_pow10) / sizeof(s_pow10[0]))
+			|| *s == 'e' || *s == 'E' || *s == 'x' || *s == 'X')
+	{
+		return strtod(text, endptr);
+	}
+
+	x = (double) mantissa / s_pow10[decimals];
+	if (endptr) *endptr = (char *) s;
+
+	return negative ? -x : x;
+}
+
 int extract_xml_str_to_double(const char *text, double *o_out)
 {
 	char   *endptr;
@@ -235,7 +315,7 @@ int extract_xml_str_to_double(const char *text, double *o_out)
 		return -1;
 	}
 	errno = 0;
-	x = strtod(text, &endptr);
+	x = extract_xml_strtod(text, &endptr);
 	if (errno) {
 		return -1;
 	}
@@ -425,7 +505,7 @@ extract_xml_tag_string(extract_alloc_t *alloc, extract_xml_tag_t *tag)
 	return buffer;
 }
 
-int extract_xml_pparse_next(extract_buffer_t *buffer, extract_xml_tag_t *out)
+int extract_xml_pparse_next_tag(extract_buffer_t *buffer, extract_xml_tag_t *out)
 {
 	int              ret = -1;
 	char            *attribute_name = NULL;
@@ -513,6 +593,23 @@ int extract_xml_pparse_next(extract_buffer_t *buffer, extract_xml_tag_t *out)
 		}
 	}
 
+	ret = 0;
+end:
+
+	extract_free(alloc, &attribute_name);
+	extract_free(alloc, &attribute_value);
+	if (ret) {
+		extract_xml_tag_free(alloc, out);
+	}
+
+	return ret;
+}
+
+int extract_xml_pparse_text(extract_buffer_t *buffer, extract_xml_tag_t *out)
+{
+	extract_alloc_t *alloc = extract_buffer_alloc(buffer);
+	char             c;
+
 	/* Read plain text until next '<'. */
 	for(;;) {
 		/* We don't use s_next() here because EOF is not an error. */
@@ -520,19 +617,156 @@ int extract_xml_pparse_next(extract_buffer_t *buffer, extract_xml_tag_t *out)
 		if (e == +1) {
 			break;   /* EOF is not an error here. */
 		}
-		if (e) goto end;
+		if (e) goto fail;
 		if (c == '<') break;
-		if (extract_astring_catc(alloc, &out->text, c)) goto end;
+		if (extract_astring_catc(alloc, &out->text, c)) goto fail;
 	}
 
-	ret = 0;
-end:
+	return 0;
 
-	extract_free(alloc, &attribute_name);
-	extract_free(alloc, &attribute_value);
-	if (ret) {
-		extract_xml_tag_free(alloc, out);
+fail:
+	extract_xml_tag_free(alloc, out);
+	return -1;
+}
+
+int extract_xml_pparse_next(extract_buffer_t *buffer, extract_xml_tag_t *out)
+{
+	int e = extract_xml_pparse_next_tag(buffer, out);
+
+	if (e) return e;
+
+	return extract_xml_pparse_text(buffer, out);
+}
+
+/* Value of each hex digit, or -1 for characters that are not hex digits.
+Like earlier versions of this code, we only accept lower-case a-f. */
+static const signed char s_hex_values[256] =
+{
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+#if defined(__SSE2__)
+/* Decodes 16 hex digits at <in> into 8 bytes at <out>. Returns -1 without
+writing anything if any of the characters is not a hex digit. */
+static int s_hex_decode16(const char *in, char *out)
+{
+	__m128i v        = _mm_loadu_si128((const __m128i *) in);
+	__m128i is_digit = _mm_and_si128(
+			_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i is_lower = _mm_and_si128(
+			_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('f' + 1)));
+	__m128i nibbles;
+	__m128i bytes;
+
+	if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_lower)) != 0xffff) return -1;
+
+	/* '0'-'9' become 0-9 and 'a'-'f' become 10-15. */
+	nibbles = _mm_sub_epi8(
+			_mm_sub_epi8(v, _mm_set1_epi8('0')),
+			_mm_and_si128(is_lower, _mm_set1_epi8('a' - '0' - 10)));
+
+	/* Each 16-bit lane contains a high nibble in its low byte and a low
+	nibble in its high byte. */
+	bytes = _mm_or_si128(
+			_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4),
+			_mm_srli_epi16(nibbles, 8));
+	_mm_storel_epi64((__m128i *) out, _mm_packus_epi16(bytes, bytes));
+
+	return 0;
+}
+#endif
+
+int extract_xml_pparse_hex(extract_buffer_t *buffer, char *data, size_t data_size)
+{
+	extract_buffer_cache_t *cache = (extract_buffer_cache_t *)(void *) buffer;
+	size_t                  i = 0;
+	size_t                  offset = 0;
+	int                     high = -1;  /* High nibble of partial byte. */
+	int                     done = 0;
+	char                    c;
+
+	while (!done) {
+		const unsigned char *p;
+		size_t               n;
+		size_t               j;
+
+		if (cache->pos == cache->numbytes) {
+			/* Nothing in cache; read one char, which will usually
+			repopulate the cache. */
+			int e = extract_buffer_read(buffer, &c, 1, NULL);
+			if (e == +1) break;  /* EOF. */
+			if (e) return -1;
+			p = (const unsigned char *) &c;
+			n = 1;
+		}
+		else {
+			/* Decode directly from the buffer's cache. */
+			p = (const unsigned char *) cache->cache + cache->pos;
+			n = cache->numbytes - cache->pos;
+		}
+
+		for (j=0; j<n; ++j) {
+			int v;
+#if defined(__SSE2__)
+			if (high < 0 && n - j >= 16 && data_size - i >= 8
+					&& !s_hex_decode16((const char *) p + j, data + i)) {
+				j += 15;
+				i += 8;
+				continue;
+			}
+#endif
+			v = s_hex_values[p[j]];
+			if (v >= 0 && i < data_size) {
+				if (high < 0) {
+					high = v;
+				}
+				else {
+					data[i++] = (char) (high * 16 + v);
+					high = -1;
+				}
+			}
+			else if (p[j] == '<') {
+				j += 1;
+				done = 1;
+				break;
+			}
+			else if (high < 0 && (p[j] == ' ' || p[j] == '\n' || i == data_size)) {
+				/* Skip whitespace between bytes, and any text after the
+				data. */
+			}
+			else {
+				outf("Unrecognised hex character '%x' at offset %lli in image data",
+						p[j], (long long) (offset + j));
+				errno = EINVAL;
+				return -1;
+			}
+		}
+		offset += j;
+		if (p != (const unsigned char *) &c) cache->pos += j;
 	}
 
-	return ret;
+	if (i != data_size) {
+		outf("Only found %lli of %lli bytes of hex image data", (long long) i, (long long) data_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
 }
@@ -63,6 +63,19 @@ each item in out->attributes has similarly valid name and value members.
 initialised, e.g. by by extract_xml_tag_init(). */
 int extract_xml_pparse_next(extract_buffer_t *buffer, extract_xml_tag_t *out);
 
+/* Like extract_xml_pparse_next() but does not read the plain text after the
+tag. This must then be consumed, up to and including the next '<', with
+extract_xml_pparse_text() or extract_xml_pparse_hex(). */
+int extract_xml_pparse_next_tag(extract_buffer_t *buffer, extract_xml_tag_t *out);
+
+/* Reads plain text up to the next '<' into out->text. */
+int extract_xml_pparse_text(extract_buffer_t *buffer, extract_xml_tag_t *out);
+
+/* Decodes <data_size> bytes of hex-encoded plain text into <data>, skipping
+spaces and newlines between bytes, and then skips any remaining text up to
+the next '<'. Reads directly from <buffer>'s cache where possible. */
+int extract_xml_pparse_hex(extract_buffer_t *buffer, char *data, size_t data_size);
+
 
 /* Returns pointer to value of specified attribute, or NULL if not found. */
 char *extract_xml_tag_attributes_find(extract_xml_tag_t *tag, const char *name);
@@ -99,6 +112,10 @@ int extract_xml_str_to_size(const char *text, size_t *o_out);
 
 int extract_xml_str_to_double(const char *text, double *o_out);
 
+/* Like strtod(), but always uses '.' as the decimal point for plain decimal
+numbers, which it parses without calling strtod(). */
+double extract_xml_strtod(const char *text, char **endptr);
+
 int extract_xml_str_to_float(const char *text, float *o_out);
 
 
@@ -40,6 +40,12 @@ struct extract_zip_t
 	uint16_t               compression_method;
 	int                    compress_level;
 
+	/* Deflate state, created by the first call to s_write_compressed() and
+	reset for each later file so that zlib does not have to allocate it
+	again. zstream_init is non-zero if zstream needs zng_deflateEnd(). */
+	zng_stream             zstream;
+	int                    zstream_init;
+
 	/* Defaults for various values in zip file headers etc. */
 	uint16_t               mtime;
 	uint16_t               mdate;
@@ -66,6 +72,7 @@ int extract_zip_open(extract_buffer_t *buffer, extract_zip_t **o_zip)
 	zip->eof = 0;
 	zip->compression_method = Z_DEFLATED;
 	zip->compress_level = Z_DEFAULT_COMPRESSION;
+	zip->zstream_init = 0;
 
 	/* We could maybe convert current date/time to the ms-dos format required
 	here, but using zeros doesn't seem to make a difference to Word etc. */
@@ -169,27 +176,41 @@ static void s_zfree(void *opaque, void *ptr)
 }
 
 
-/* Uses zlib to write raw deflate compressed data to zip->buffer. */
-static int
-s_write_compressed(
-		extract_zip_t *zip,
-		const void    *data,
-		size_t         data_length,
-		size_t        *o_compressed_length)
+/* Frees zip->zstream if it has been initialised. */
+static int s_zstream_end(extract_zip_t *zip)
 {
-	int      ze;
-    zng_stream zstream = {0};  /* Initialise to keep Coverity quiet. */
+	int ze;
+
+	if (!zip->zstream_init) return Z_OK;
+	zip->zstream_init = 0;
+	ze = zng_deflateEnd(&zip->zstream);
+	/* Z_DATA_ERROR just means that the stream was freed before it finished,
+	e.g. after a write error. */
+	return (ze == Z_DATA_ERROR) ? Z_OK : ze;
+}
 
-	if (zip->errno_)    return -1;
-	if (zip->eof)       return +1;
+/* Makes zip->zstream ready to compress a new file. */
+static int s_zstream_begin(extract_zip_t *zip)
+{
+	zng_stream *zstream = &zip->zstream;
+	int         ze;
 
-	zstream.zalloc = s_zalloc;
-	zstream.zfree = s_zfree;
-	zstream.opaque = zip;
+	if (zip->zstream_init)
+	{
+		ze = zng_deflateReset(zstream);
+		if (ze == Z_OK) return 0;
+		outf("deflateReset() failed ze=%i", ze);
+		s_zstream_end(zip);
+	}
+
+	extract_bzero(zstream, sizeof(*zstream));
+	zstream->zalloc = s_zalloc;
+	zstream->zfree = s_zfree;
+	zstream->opaque = zip;
 
 	/* We need to write raw deflate data, so we use deflateInit2() with -ve
 	windowBits. The values we use are deflateInit()'s defaults. */
-    ze = zng_deflateInit2(&zstream,
+	ze = zng_deflateInit2(zstream,
 			zip->compress_level,
 			Z_DEFLATED,
 			-15 /*windowBits*/,
@@ -202,10 +223,30 @@ s_write_compressed(
 		outf("deflateInit2() failed ze=%i", ze);
 		return -1;
 	}
+	zip->zstream_init = 1;
+
+	return 0;
+}
+
+/* Uses zlib to write raw deflate compressed data to zip->buffer. */
+static int
+s_write_compressed(
+		extract_zip_t *zip,
+		const void    *data,
+		size_t         data_length,
+		size_t        *o_compressed_length)
+{
+	int         ze;
+	zng_stream *zstream = &zip->zstream;
+
+	if (zip->errno_)    return -1;
+	if (zip->eof)       return +1;
+
+	if (s_zstream_begin(zip)) return -1;
 
 	/* Set zstream to read from specified data. */
-	zstream.next_in = (void*) data;
-	zstream.avail_in = (unsigned) data_length;
+	zstream->next_in = (void*) data;
+	zstream->avail_in = (unsigned) data_length;
 
 	/* We increment *o_compressed_length gradually so that if we return an
 	error, we still indicate how many butes of compressed data have been
@@ -220,21 +261,21 @@ s_write_compressed(
 		/* todo: write an extract_buffer_cache() function so we can write
 		directly into output buffer if it has a fn_cache. */
 		unsigned char   buffer[1024];
-		zstream.next_out = &buffer[0];
-		zstream.avail_out = sizeof(buffer);
-        ze = zng_deflate(&zstream, zstream.avail_in ? Z_NO_FLUSH : Z_FINISH);
+		zstream->next_out = &buffer[0];
+		zstream->avail_out = sizeof(buffer);
+		ze = zng_deflate(zstream, zstream->avail_in ? Z_NO_FLUSH : Z_FINISH);
 		if (ze != Z_STREAM_END && ze != Z_OK)
 		{
 			outf("deflate() failed ze=%i", ze);
 			errno = EIO;
 			zip->errno_ = errno;
-            (void)deflateEnd(&zstream);
+			(void) s_zstream_end(zip);
 			return -1;
 		}
 		{
 			/* Send the new compressed data to buffer. */
 			size_t  bytes_written;
-			int e = extract_buffer_write(zip->buffer, buffer, zstream.next_out - buffer, &bytes_written);
+			int e = extract_buffer_write(zip->buffer, buffer, zstream->next_out - buffer, &bytes_written);
 			if (o_compressed_length)
 			{
 				*o_compressed_length += bytes_written;
@@ -244,7 +285,7 @@ s_write_compressed(
 				if (e == -1)    zip->errno_ = errno;
 				if (e ==  +1)   zip->eof = 1;
 				outf("extract_buffer_write() failed e=%i errno=%i", e, errno);
-                (void)deflateEnd(&zstream);
+				(void) s_zstream_end(zip);
 				return e;
 			}
 		}
@@ -253,17 +294,9 @@ s_write_compressed(
 			break;
 		}
 	}
-    ze = zng_deflateEnd(&zstream);
-	if (ze != Z_OK)
-	{
-		outf("deflateEnd() failed ze=%i", ze);
-		errno = EIO;
-		zip->errno_ = errno;
-		return -1;
-	}
 	if (o_compressed_length)
 	{
-		assert(*o_compressed_length == (size_t) zstream.total_out);
+		assert(*o_compressed_length == (size_t) zstream->total_out);
 	}
 
 	return 0;
@@ -488,6 +521,13 @@ int extract_zip_close(extract_zip_t **pzip)
 	s_write_string(zip, zip->archive_comment);
 	extract_free(alloc, &zip->archive_comment);
 
+	if (s_zstream_end(zip) != Z_OK && !zip->errno_)
+	{
+		outf("deflateEnd() failed");
+		errno = EIO;
+		zip->errno_ = errno;
+	}
+
 	if (zip->errno_)    e = -1;
 	else if (zip->eof)  e = +1;
 	else e = 0;